@@ -0,0 +1,166 @@
+#include "cd-read-ahead.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/cd-reader.h"
+
+#include "clowncd-callbacks.h"
+#include "worker-thread.h"
+
+/* How many sectors are read ahead of the emulator. Must not exceed 'WORKER_THREAD_QUEUE_LENGTH'. */
+#define CD_READ_AHEAD_RING_LENGTH 16
+
+struct CDReadAhead
+{
+	WorkerThread *worker;
+
+	/* Only accessed by the worker thread, or when no jobs are pending. */
+	CDReader_State reader;
+	cc_u32f reader_position;
+	cc_bool reader_positioned;
+
+	/* Sectors 'next_sector' up to (but not including) 'end_sector' have been submitted to the worker. Each job is a slot index. */
+	cc_bool positioned;
+	cc_u32f next_sector;
+	cc_u32f end_sector;
+	cc_u32f slot_sectors[CD_READ_AHEAD_RING_LENGTH];
+	cc_u16l slots[CD_READ_AHEAD_RING_LENGTH][CD_READ_AHEAD_SECTOR_WORDS];
+
+	/* Reads served straight from the ring, reads that had to wait for the worker, and reads that the caller had to do itself. */
+	unsigned long hits;
+	unsigned long waits;
+	unsigned long misses;
+	unsigned long discarded_sectors;
+};
+
+static void ReadSectorJob(void* const user_data, const cc_u16f job)
+{
+	CDReadAhead* const read_ahead = (CDReadAhead*)user_data;
+	const cc_u32f sector_index = read_ahead->slot_sectors[job];
+
+	if (!read_ahead->reader_positioned || read_ahead->reader_position != sector_index)
+		CDReader_SeekToSector(&read_ahead->reader, sector_index);
+
+	CDReader_ReadSector(&read_ahead->reader, read_ahead->slots[job]);
+
+	read_ahead->reader_position = sector_index + 1;
+	read_ahead->reader_positioned = cc_true;
+}
+
+static void FillRing(CDReadAhead* const read_ahead)
+{
+	while (read_ahead->end_sector - read_ahead->next_sector < CD_READ_AHEAD_RING_LENGTH)
+	{
+		const cc_u16f slot = read_ahead->end_sector % CD_READ_AHEAD_RING_LENGTH;
+
+		/* The slot was last submitted this many jobs ago, and its sector has since been consumed or skipped.
+		   If it was skipped, then its job may still be pending, so wait for it before reusing the slot. */
+		WorkerThread_WaitForPendingJobs(read_ahead->worker, CD_READ_AHEAD_RING_LENGTH - 1);
+
+		read_ahead->slot_sectors[slot] = read_ahead->end_sector;
+		WorkerThread_Submit(read_ahead->worker, slot);
+		++read_ahead->end_sector;
+	}
+}
+
+CDReadAhead* CDReadAhead_Create(const char* const path)
+{
+	CDReadAhead* const read_ahead = (CDReadAhead*)calloc(1, sizeof(CDReadAhead));
+
+	if (read_ahead != NULL)
+	{
+		read_ahead->worker = WorkerThread_Create(ReadSectorJob, read_ahead);
+
+		if (read_ahead->worker != NULL)
+		{
+			CDReader_Initialise(&read_ahead->reader);
+			CDReader_Open(&read_ahead->reader, NULL, path, &clowncd_callbacks);
+
+			if (CDReader_IsOpen(&read_ahead->reader))
+				return read_ahead;
+
+			CDReader_Deinitialise(&read_ahead->reader);
+			WorkerThread_Destroy(read_ahead->worker);
+		}
+
+		free(read_ahead);
+	}
+
+	return NULL;
+}
+
+void CDReadAhead_Destroy(CDReadAhead* const read_ahead)
+{
+	WorkerThread_Destroy(read_ahead->worker);
+
+	libretro_callbacks.log(RETRO_LOG_INFO, "CD read-ahead: %lu hits, %lu waits, %lu misses, %lu sectors discarded by seeks.\n", read_ahead->hits, read_ahead->waits, read_ahead->misses, read_ahead->discarded_sectors);
+
+	CDReader_Close(&read_ahead->reader);
+	CDReader_Deinitialise(&read_ahead->reader);
+	free(read_ahead);
+}
+
+void CDReadAhead_Seek(CDReadAhead* const read_ahead, const cc_u32f sector_index)
+{
+	if (read_ahead->positioned && sector_index - read_ahead->next_sector < read_ahead->end_sector - read_ahead->next_sector)
+	{
+		/* The sector is already in the ring, so just skip to it. */
+		read_ahead->discarded_sectors += sector_index - read_ahead->next_sector;
+		read_ahead->next_sector = sector_index;
+	}
+	else
+	{
+		/* The worker has to finish before its slots can be reassigned. Jobs that are still
+		   pending belong to the same few sectors, so this is usually brief. */
+		WorkerThread_Finish(read_ahead->worker);
+
+		if (read_ahead->positioned)
+			read_ahead->discarded_sectors += read_ahead->end_sector - read_ahead->next_sector;
+
+		read_ahead->positioned = cc_true;
+		read_ahead->next_sector = read_ahead->end_sector = sector_index;
+	}
+
+	FillRing(read_ahead);
+}
+
+void CDReadAhead_Invalidate(CDReadAhead* const read_ahead)
+{
+	read_ahead->positioned = cc_false;
+}
+
+cc_bool CDReadAhead_ReadSector(CDReadAhead* const read_ahead, cc_u16l* const buffer)
+{
+	const cc_u16f sectors_in_ring = read_ahead->end_sector - read_ahead->next_sector;
+
+	if (!read_ahead->positioned)
+	{
+		++read_ahead->misses;
+		return cc_false;
+	}
+
+	/* Jobs finish in order, so the next sector is ready once fewer jobs than there are sectors in the ring are pending. */
+	if (WorkerThread_GetPendingJobs(read_ahead->worker) < sectors_in_ring)
+	{
+		++read_ahead->hits;
+	}
+	else
+	{
+		++read_ahead->waits;
+		WorkerThread_WaitForPendingJobs(read_ahead->worker, sectors_in_ring - 1);
+	}
+
+	memcpy(buffer, read_ahead->slots[read_ahead->next_sector % CD_READ_AHEAD_RING_LENGTH], sizeof(read_ahead->slots[0]));
+	++read_ahead->next_sector;
+
+	FillRing(read_ahead);
+
+	return cc_true;
+}
+
+cc_bool CDReadAhead_GetPosition(const CDReadAhead* const read_ahead, cc_u32f* const sector_index)
+{
+	*sector_index = read_ahead->next_sector;
+	return read_ahead->positioned;
+}
@@ -0,0 +1,28 @@
+#ifndef CD_READ_AHEAD_H
+#define CD_READ_AHEAD_H
+
+#include "libretro-interface.h"
+
+/* The number of 16-bit words in the user data of a sector, as produced by 'CDReader_ReadSector'. */
+#define CD_READ_AHEAD_SECTOR_WORDS (2048 / 2)
+
+typedef struct CDReadAhead CDReadAhead;
+
+/* Reads the sectors that follow the most recent seek on a worker thread, using a reader of its own,
+   so that decoding (such as CHD hunk decompression) happens outside of the emulator's frame.
+   Returns NULL if threads are unavailable or the disc could not be opened. */
+CDReadAhead* CDReadAhead_Create(const char *path);
+/* Logs how many sector reads were served from the ring. */
+void CDReadAhead_Destroy(CDReadAhead *read_ahead);
+
+/* Starts reading ahead from the given sector. */
+void CDReadAhead_Seek(CDReadAhead *read_ahead, cc_u32f sector_index);
+/* Forgets the current position, such as after a state is loaded. Reading ahead resumes after the next seek. */
+void CDReadAhead_Invalidate(CDReadAhead *read_ahead);
+/* Reads the next sector, waiting for it if it is still being decoded.
+   Returns cc_false if the position is not known, in which case the caller must read the sector itself. */
+cc_bool CDReadAhead_ReadSector(CDReadAhead *read_ahead, cc_u16l *buffer);
+/* Obtains the sector that will be read next. Returns cc_false if the position is not known. */
+cc_bool CDReadAhead_GetPosition(const CDReadAhead *read_ahead, cc_u32f *sector_index);
+
+#endif /* CD_READ_AHEAD_H */
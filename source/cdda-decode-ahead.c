@@ -0,0 +1,233 @@
+#include "cdda-decode-ahead.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "worker-thread.h"
+
+/* Audio is decoded in chunks of this many stereo frames, about one CD sector's worth. */
+#define CDDA_DECODE_AHEAD_CHUNK_FRAMES 588
+
+/* How many chunks are decoded ahead of the emulator, which is roughly 100 milliseconds of audio. Must not exceed 'WORKER_THREAD_QUEUE_LENGTH'. */
+#define CDDA_DECODE_AHEAD_CHUNKS_AHEAD 8
+
+/* The ring also keeps as many chunks that have already been read, so that rolling back by a few frames, as run-ahead and netplay do every frame, does not need them to be decoded again. */
+#define CDDA_DECODE_AHEAD_RING_LENGTH (CDDA_DECODE_AHEAD_CHUNKS_AHEAD * 2)
+
+struct CDDADecodeAhead
+{
+	WorkerThread *worker;
+
+	/* Only accessed by the worker thread, or when no jobs are pending. */
+	CDReader_State reader;
+
+	/* Chunks up to (but not including) 'end_chunk' have been submitted to the worker, and those before 'next_chunk' have been read.
+	   Each job is a slot index. 'chunk_position' is how many frames of the next chunk have already been read.
+	   Each chunk also holds the state of the reader from just before the chunk was decoded. */
+	cc_bool started;
+	cc_u32f next_chunk;
+	cc_u32f end_chunk;
+	cc_u32f chunk_position;
+	cc_u32f chunk_frames[CDDA_DECODE_AHEAD_RING_LENGTH];
+	CDReader_StateBackup chunk_states[CDDA_DECODE_AHEAD_RING_LENGTH];
+	cc_s16l chunks[CDDA_DECODE_AHEAD_RING_LENGTH][CDDA_DECODE_AHEAD_CHUNK_FRAMES * 2];
+
+	/* Reads served straight from the ring, and reads that had to wait for the worker. */
+	unsigned long hits;
+	unsigned long waits;
+};
+
+static void DecodeChunkJob(void* const user_data, const cc_u16f job)
+{
+	CDDADecodeAhead* const decode_ahead = (CDDADecodeAhead*)user_data;
+	cc_u32f total_frames = 0;
+
+	/* Zeroed first, so that equal states compare equal regardless of padding. */
+	memset(&decode_ahead->chunk_states[job], 0, sizeof(decode_ahead->chunk_states[job]));
+	CDReader_SaveState(&decode_ahead->reader, &decode_ahead->chunk_states[job]);
+
+	/* When a track repeats, or playback moves on to the next track, the reader may stop short at the end of the track.
+	   Keep reading so that the chunk continues seamlessly into whatever plays next. */
+	while (total_frames != CDDA_DECODE_AHEAD_CHUNK_FRAMES)
+	{
+		const cc_u32f frames = CDReader_ReadAudio(&decode_ahead->reader, &decode_ahead->chunks[job][total_frames * 2], CDDA_DECODE_AHEAD_CHUNK_FRAMES - total_frames);
+
+		if (frames == 0)
+			break;
+
+		total_frames += frames;
+	}
+
+	decode_ahead->chunk_frames[job] = total_frames;
+}
+
+static void SubmitChunks(CDDADecodeAhead* const decode_ahead)
+{
+	while (decode_ahead->end_chunk - decode_ahead->next_chunk < CDDA_DECODE_AHEAD_CHUNKS_AHEAD)
+	{
+		/* The slot's previous job has been read by now, so it has certainly finished. */
+		WorkerThread_Submit(decode_ahead->worker, decode_ahead->end_chunk % CDDA_DECODE_AHEAD_RING_LENGTH);
+		++decode_ahead->end_chunk;
+	}
+}
+
+CDDADecodeAhead* CDDADecodeAhead_Create(const char* const path, const ClownCD_FileCallbacks* const callbacks)
+{
+	CDDADecodeAhead* const decode_ahead = (CDDADecodeAhead*)calloc(1, sizeof(CDDADecodeAhead));
+
+	if (decode_ahead != NULL)
+	{
+		decode_ahead->worker = WorkerThread_Create(DecodeChunkJob, decode_ahead);
+
+		if (decode_ahead->worker != NULL)
+		{
+			CDReader_Initialise(&decode_ahead->reader);
+			CDReader_Open(&decode_ahead->reader, NULL, path, callbacks);
+
+			if (CDReader_IsOpen(&decode_ahead->reader))
+				return decode_ahead;
+
+			CDReader_Deinitialise(&decode_ahead->reader);
+			WorkerThread_Destroy(decode_ahead->worker);
+		}
+
+		free(decode_ahead);
+	}
+
+	return NULL;
+}
+
+void CDDADecodeAhead_Destroy(CDDADecodeAhead* const decode_ahead)
+{
+	WorkerThread_Destroy(decode_ahead->worker);
+
+	libretro_callbacks.log(RETRO_LOG_INFO, "CDDA decode-ahead: %lu hits, %lu waits.\n", decode_ahead->hits, decode_ahead->waits);
+
+	CDReader_Close(&decode_ahead->reader);
+	CDReader_Deinitialise(&decode_ahead->reader);
+	free(decode_ahead);
+}
+
+static cc_bool FindChunk(CDDADecodeAhead* const decode_ahead, const CDReader_StateBackup* const backup, cc_u32f* const chunk)
+{
+	/* Only chunks that have finished decoding and whose slots have not been reused yet can be searched. */
+	const cc_u32f finished_chunks = decode_ahead->end_chunk - WorkerThread_GetPendingJobs(decode_ahead->worker);
+	const cc_u32f first_chunk = decode_ahead->end_chunk > CDDA_DECODE_AHEAD_RING_LENGTH ? decode_ahead->end_chunk - CDDA_DECODE_AHEAD_RING_LENGTH : 0;
+	cc_u32f i;
+
+	if (!decode_ahead->started)
+		return cc_false;
+
+	for (i = first_chunk; i < finished_chunks; ++i)
+	{
+		if (memcmp(&decode_ahead->chunk_states[i % CDDA_DECODE_AHEAD_RING_LENGTH], backup, sizeof(*backup)) == 0)
+		{
+			*chunk = i;
+			return cc_true;
+		}
+	}
+
+	return cc_false;
+}
+
+static void WaitForNextChunk(CDDADecodeAhead* const decode_ahead, cc_bool* const waited)
+{
+	const cc_u16f chunks_in_ring = decode_ahead->end_chunk - decode_ahead->next_chunk;
+
+	/* Jobs finish in order, so the next chunk is ready once fewer jobs than there are chunks in the ring are pending. */
+	if (WorkerThread_GetPendingJobs(decode_ahead->worker) >= chunks_in_ring)
+	{
+		*waited = cc_true;
+		WorkerThread_WaitForPendingJobs(decode_ahead->worker, chunks_in_ring - 1);
+	}
+}
+
+void CDDADecodeAhead_Start(CDDADecodeAhead* const decode_ahead, const CDReader_StateBackup* const backup, const cc_u32f frame_offset)
+{
+	cc_u32f chunk;
+
+	if (FindChunk(decode_ahead, backup, &chunk))
+	{
+		/* The position has already been decoded, so just go back to it. Chunks after it follow on from it, so they are still valid. */
+		decode_ahead->next_chunk = chunk;
+	}
+	else
+	{
+		/* Everything that was decoded belongs to another position, so discard it. */
+		WorkerThread_Finish(decode_ahead->worker);
+
+		CDReader_LoadState(&decode_ahead->reader, backup);
+
+		decode_ahead->started = cc_true;
+		decode_ahead->next_chunk = decode_ahead->end_chunk = 0;
+
+		SubmitChunks(decode_ahead);
+	}
+
+	/* A frame offset from a save state may lie beyond the end of the chunk, so clamp it. */
+	decode_ahead->chunk_position = CC_MIN(frame_offset, CDDA_DECODE_AHEAD_CHUNK_FRAMES);
+}
+
+void CDDADecodeAhead_Stop(CDDADecodeAhead* const decode_ahead)
+{
+	/* Any pending jobs are left to finish, and are discarded by the next start. */
+	decode_ahead->started = cc_false;
+}
+
+cc_bool CDDADecodeAhead_GetPosition(CDDADecodeAhead* const decode_ahead, CDReader_StateBackup* const backup, cc_u32f* const frame_offset)
+{
+	cc_bool waited = cc_false;
+
+	if (!decode_ahead->started)
+		return cc_false;
+
+	WaitForNextChunk(decode_ahead, &waited);
+
+	/* Copied byte-for-byte, so that it can be found again by 'FindChunk'. */
+	memcpy(backup, &decode_ahead->chunk_states[decode_ahead->next_chunk % CDDA_DECODE_AHEAD_RING_LENGTH], sizeof(*backup));
+	*frame_offset = decode_ahead->chunk_position;
+
+	return cc_true;
+}
+
+cc_bool CDDADecodeAhead_Read(CDDADecodeAhead* const decode_ahead, cc_s16l* const sample_buffer, const cc_u32f total_frames, cc_u32f* const frames_read)
+{
+	cc_bool waited = cc_false;
+
+	if (!decode_ahead->started)
+		return cc_false;
+
+	*frames_read = 0;
+
+	while (*frames_read != total_frames)
+	{
+		const cc_u16f slot = decode_ahead->next_chunk % CDDA_DECODE_AHEAD_RING_LENGTH;
+		cc_u32f frames;
+
+		WaitForNextChunk(decode_ahead, &waited);
+
+		/* An empty chunk means that playback has ended. Any chunks after it will be empty too. */
+		if (decode_ahead->chunk_frames[slot] == 0)
+			break;
+
+		/* The chunk may be shorter than the offset that it was started at, if playback ended within it. */
+		frames = CC_MIN(total_frames - *frames_read, decode_ahead->chunk_frames[slot] - CC_MIN(decode_ahead->chunk_position, decode_ahead->chunk_frames[slot]));
+		memcpy(&sample_buffer[*frames_read * 2], &decode_ahead->chunks[slot][decode_ahead->chunk_position * 2], frames * 2 * sizeof(cc_s16l));
+		*frames_read += frames;
+		decode_ahead->chunk_position += frames;
+
+		if (decode_ahead->chunk_position >= decode_ahead->chunk_frames[slot])
+		{
+			decode_ahead->chunk_position = 0;
+			++decode_ahead->next_chunk;
+			SubmitChunks(decode_ahead);
+		}
+	}
+
+	if (waited)
+		++decode_ahead->waits;
+	else
+		++decode_ahead->hits;
+
+	return cc_true;
+}
@@ -0,0 +1,31 @@
+#ifndef CDDA_DECODE_AHEAD_H
+#define CDDA_DECODE_AHEAD_H
+
+#include "../common/cd-reader.h"
+
+#include "libretro-interface.h"
+
+typedef struct CDDADecodeAhead CDDADecodeAhead;
+
+/* Decodes CD audio ahead of the emulator on a worker thread, using a reader of its own, so that decompressing
+   FLAC, MP3, Ogg Vorbis or CHD audio happens outside of the emulator's frame.
+   Returns NULL if threads are unavailable or the disc could not be opened. */
+CDDADecodeAhead* CDDADecodeAhead_Create(const char *path, const ClownCD_FileCallbacks *callbacks);
+/* Logs how many reads were served without waiting. */
+void CDDADecodeAhead_Destroy(CDDADecodeAhead *decode_ahead);
+
+/* Starts decoding from the audio position in the given state, skipping the given number of frames, which is usually the
+   position of the caller's own reader just after it has begun playing a track, or one from 'CDDADecodeAhead_GetPosition'
+   that has been loaded from a save state. If that position has already been decoded, nothing is decoded again. */
+void CDDADecodeAhead_Start(CDDADecodeAhead *decode_ahead, const CDReader_StateBackup *backup, cc_u32f frame_offset);
+/* Makes 'CDDADecodeAhead_Read' return cc_false until the next start, such as when the caller's reader seeks away from the audio. */
+void CDDADecodeAhead_Stop(CDDADecodeAhead *decode_ahead);
+/* Gets the position of the next frame to be read, as a reader state and a number of frames to skip after loading it,
+   without decoding anything. Returns cc_false if decoding has not been started. */
+cc_bool CDDADecodeAhead_GetPosition(CDDADecodeAhead *decode_ahead, CDReader_StateBackup *backup, cc_u32f *frame_offset);
+/* Reads the next frames, waiting for them if they are still being decoded. Like 'CDReader_ReadAudio', fewer frames
+   than were requested are read once playback ends. Returns cc_false if decoding has not been started, in which case
+   the caller must read the frames itself. */
+cc_bool CDDADecodeAhead_Read(CDDADecodeAhead *decode_ahead, cc_s16l *sample_buffer, cc_u32f total_frames, cc_u32f *frames_read);
+
+#endif /* CDDA_DECODE_AHEAD_H */
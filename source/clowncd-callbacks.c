@@ -1,8 +1,57 @@
 #include "clowncd-callbacks.h"
 
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "file-io.h"
 
-static void* ClownCDFileOpen(const char* const filename, const ClownCD_FileMode mode)
+/* Reads of files are rounded out to aligned blocks of this many bytes, so that the many small reads and
+   seeks made by the disc image parsers do not each become a call to the VFS. Zero disables buffering. */
+static size_t block_size = 64 * 1024;
+
+typedef struct BufferedFile
+{
+	struct retro_vfs_file_handle *handle;
+
+	/* The buffer holds 'buffer_length' bytes of the file, starting at 'buffer_position'. */
+	unsigned char *buffer;
+	size_t buffer_size;
+	size_t buffer_length;
+	int64_t buffer_position;
+
+	/* Where the caller is in the file, and where the handle actually is. The latter is -1 if it is not known. */
+	int64_t position;
+	int64_t handle_position;
+
+	/* Calls made by the caller, and calls made to the VFS on its behalf. */
+	unsigned long requests;
+	unsigned long vfs_calls;
+} BufferedFile;
+
+/* Preloaded files are read in pieces of this size, so that progress can be logged. */
+#define PRELOAD_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct PreloadedFile
+{
+	struct PreloadedFile *next;
+	char *path;
+	unsigned char *data; /* NULL if the file could not be preloaded. */
+	size_t size;
+} PreloadedFile;
+
+typedef struct PreloadedStream
+{
+	/* NULL if the file could not be preloaded, in which case 'handle' is used instead. */
+	PreloadedFile *file;
+	void *handle;
+	size_t position;
+} PreloadedStream;
+
+static PreloadedFile *preloaded_files;
+static cc_bool preloaded_files_frozen; /* Once set, the list is only read, so that it can be shared between threads. */
+
+static struct retro_vfs_file_handle* OpenFile(const char* const filename, const ClownCD_FileMode mode)
 {
 	int libretro_mode;
 
@@ -23,74 +72,241 @@ static void* ClownCDFileOpen(const char* const filename, const ClownCD_FileMode
 	return file_io.open(filename, libretro_mode, RETRO_VFS_FILE_ACCESS_HINT_NONE);
 }
 
+static cc_bool PositionHandle(BufferedFile* const file)
+{
+	if (file->handle_position != file->position)
+	{
+		++file->vfs_calls;
+		file->handle_position = file_io.seek(file->handle, file->position, RETRO_VFS_SEEK_POSITION_START);
+
+		if (file->handle_position != file->position)
+		{
+			file->handle_position = -1;
+			return cc_false;
+		}
+	}
+
+	return cc_true;
+}
+
+static int64_t ReadHandle(BufferedFile* const file, void* const buffer, const size_t size)
+{
+	int64_t total_read;
+
+	++file->vfs_calls;
+	total_read = file_io.read(file->handle, buffer, size);
+
+	if (total_read < 0)
+		file->handle_position = -1;
+	else
+		file->handle_position += total_read;
+
+	return total_read;
+}
+
+static void* ClownCDFileOpen(const char* const filename, const ClownCD_FileMode mode)
+{
+	/* Files that are written are not buffered. */
+	const size_t buffer_size = mode == CLOWNCD_RB ? block_size : 0;
+	BufferedFile* const file = (BufferedFile*)malloc(sizeof(BufferedFile) + buffer_size);
+
+	if (file != NULL)
+	{
+		file->handle = OpenFile(filename, mode);
+
+		if (file->handle != NULL)
+		{
+			file->buffer = (unsigned char*)(file + 1);
+			file->buffer_size = buffer_size;
+			file->buffer_position = 0;
+			file->buffer_length = 0;
+			file->position = 0;
+			file->handle_position = 0;
+			file->requests = 0;
+			file->vfs_calls = 0;
+
+			return file;
+		}
+
+		free(file);
+	}
+
+	return NULL;
+}
+
 static int ClownCDFileClose(void* const stream)
 {
-	return file_io.close((struct retro_vfs_file_handle*)stream);
+	BufferedFile* const file = (BufferedFile*)stream;
+	const int result = file_io.close(file->handle);
+
+	if (file->buffer_size != 0)
+		libretro_callbacks.log(RETRO_LOG_DEBUG, "CD file I/O: %lu requests served with %lu VFS calls.\n", file->requests, file->vfs_calls);
+
+	free(file);
+
+	return result;
 }
 
 static size_t ClownCDFileRead(void* const buffer, const size_t size, const size_t count, void* const stream)
 {
-	int64_t total_read;
+	BufferedFile* const file = (BufferedFile*)stream;
+	unsigned char *output = (unsigned char*)buffer;
+	size_t remaining, total_read;
+
+	++file->requests;
 
 	if (size == 0 || count == 0)
 		return 0;
 
-	total_read = file_io.read((struct retro_vfs_file_handle*)stream, buffer, size * count) / size;
+	remaining = size * count;
 
-	if (total_read < 0 || (uint64_t)total_read > (size_t)-1)
-		return 0;
+	while (remaining != 0)
+	{
+		if (file->position >= file->buffer_position && file->position - file->buffer_position < (int64_t)file->buffer_length)
+		{
+			/* Serve what we can from the buffer. */
+			const size_t offset = (size_t)(file->position - file->buffer_position);
+			const size_t length = CC_MIN(remaining, file->buffer_length - offset);
 
-	return total_read;
+			memcpy(output, &file->buffer[offset], length);
+			output += length;
+			remaining -= length;
+			file->position += length;
+		}
+		else if (remaining >= file->buffer_size)
+		{
+			/* Reads that are at least as large as the buffer gain nothing from it, so go straight to the file. */
+			int64_t length;
+
+			if (!PositionHandle(file))
+				break;
+
+			length = ReadHandle(file, output, remaining);
+
+			if (length <= 0)
+				break;
+
+			output += length;
+			remaining -= (size_t)length;
+			file->position += length;
+		}
+		else
+		{
+			/* Refill the buffer with the aligned block that contains the position, so that nearby seeks land within it. */
+			const int64_t position = file->position;
+			int64_t length;
+
+			file->buffer_length = 0;
+			file->position -= file->position % (int64_t)file->buffer_size;
+
+			if (!PositionHandle(file))
+			{
+				file->position = position;
+				break;
+			}
+
+			length = ReadHandle(file, file->buffer, file->buffer_size);
+
+			file->buffer_position = file->position;
+			file->buffer_length = length < 0 ? 0 : (size_t)length;
+			file->position = position;
+
+			/* Stop at the end of the file. */
+			if (file->position - file->buffer_position >= (int64_t)file->buffer_length)
+				break;
+		}
+	}
+
+	total_read = size * count - remaining;
+
+	return total_read / size;
 }
 
 static size_t ClownCDFileWrite(const void* const buffer, const size_t size, const size_t count, void* const stream)
 {
+	BufferedFile* const file = (BufferedFile*)stream;
 	int64_t total_written;
 
+	++file->requests;
+
 	if (size == 0 || count == 0)
 		return 0;
 
-	total_written = file_io.write((struct retro_vfs_file_handle*)stream, buffer, size * count) / size;
+	if (!PositionHandle(file))
+		return 0;
+
+	++file->vfs_calls;
+	total_written = file_io.write(file->handle, buffer, size * count);
 
-	if (total_written < 0 || (uint64_t)total_written > (size_t)-1)
+	if (total_written < 0)
+	{
+		file->handle_position = -1;
+		return 0;
+	}
+
+	file->handle_position += total_written;
+	file->position += total_written;
+
+	if ((uint64_t)(total_written / size) > (size_t)-1)
 		return 0;
 
-	return total_written;
+	return total_written / size;
 }
 
 static long ClownCDFileTell(void* const stream)
 {
-	const int64_t position = file_io.tell((struct retro_vfs_file_handle*)stream);
+	BufferedFile* const file = (BufferedFile*)stream;
+
+	++file->requests;
 
-	if (position < 0 || position > LONG_MAX)
+	if (file->position > LONG_MAX)
 		return -1;
 
-	return position;
+	return (long)file->position;
 }
 
 static int ClownCDFileSeek(void* const stream, const long position, const ClownCD_FileOrigin origin)
 {
-	int libretro_origin;
+	BufferedFile* const file = (BufferedFile*)stream;
+	int64_t base;
+
+	++file->requests;
 
+	/* Seeks only move the logical position: the file itself is seeked when it next needs to be read. */
 	switch (origin)
 	{
 		case CLOWNCD_SEEK_SET:
-			libretro_origin = RETRO_VFS_SEEK_POSITION_START;
+			base = 0;
 			break;
 
 		case CLOWNCD_SEEK_CUR:
-			libretro_origin = RETRO_VFS_SEEK_POSITION_CURRENT;
+			base = file->position;
 			break;
 
 		case CLOWNCD_SEEK_END:
-			libretro_origin = RETRO_VFS_SEEK_POSITION_END;
+			++file->vfs_calls;
+			base = file_io.get_size(file->handle);
+
+			if (base < 0)
+				return -1;
+
 			break;
 
 		default:
 			return -1;
 	}
 
-	return file_io.seek((struct retro_vfs_file_handle*)stream, position, libretro_origin) == -1 ? -1 : 0;
+	if (base + position < 0)
+		return -1;
+
+	file->position = base + position;
+
+	return 0;
+}
+
+void ClownCDCallbacks_SetBlockSize(const size_t size)
+{
+	block_size = size;
 }
 
 const ClownCD_FileCallbacks clowncd_callbacks = {
@@ -101,3 +317,260 @@ const ClownCD_FileCallbacks clowncd_callbacks = {
 	ClownCDFileTell,
 	ClownCDFileSeek
 };
+
+/*************/
+/* Preloaded */
+/*************/
+
+static void PreloadFileData(PreloadedFile* const file)
+{
+	struct retro_vfs_file_handle* const handle = file_io.open(file->path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+	int64_t file_size;
+	size_t total_read;
+	unsigned int percent_logged;
+
+	if (handle == NULL)
+		return;
+
+	file_size = file_io.get_size(handle);
+
+	if (file_size < 0 || (uint64_t)file_size > (size_t)-1)
+	{
+		file_io.close(handle);
+		return;
+	}
+
+	file->data = (unsigned char*)malloc(file_size != 0 ? (size_t)file_size : 1);
+
+	if (file->data == NULL)
+	{
+		libretro_callbacks.log(RETRO_LOG_WARN, "Not enough memory to preload '%s' (%luMiB): it will be read from storage instead.\n", file->path, (unsigned long)(file_size / (1024 * 1024)));
+		file_io.close(handle);
+		return;
+	}
+
+	file->size = (size_t)file_size;
+
+	libretro_callbacks.log(RETRO_LOG_INFO, "Preloading '%s' (%luMiB).\n", file->path, (unsigned long)(file->size / (1024 * 1024)));
+
+	total_read = 0;
+	percent_logged = 0;
+
+	while (total_read != file->size)
+	{
+		const size_t chunk_size = CC_MIN(file->size - total_read, PRELOAD_CHUNK_SIZE);
+		const unsigned int percent = (unsigned int)((double)(total_read + chunk_size) * 100 / file->size);
+
+		if (file_io.read(handle, &file->data[total_read], chunk_size) != (int64_t)chunk_size)
+			break;
+
+		total_read += chunk_size;
+
+		/* Large files take a while, so report how far along they are. */
+		if (percent / 10 != percent_logged / 10)
+		{
+			libretro_callbacks.log(RETRO_LOG_INFO, "Preloading '%s': %u%%.\n", file->path, percent);
+			percent_logged = percent;
+		}
+	}
+
+	file_io.close(handle);
+
+	if (total_read != file->size)
+	{
+		libretro_callbacks.log(RETRO_LOG_WARN, "Could not preload '%s': it will be read from storage instead.\n", file->path);
+		free(file->data);
+		file->data = NULL;
+		file->size = 0;
+	}
+}
+
+static PreloadedFile* PreloadFile(const char* const filename)
+{
+	PreloadedFile *file;
+
+	for (file = preloaded_files; file != NULL; file = file->next)
+		if (strcmp(file->path, filename) == 0)
+			break;
+
+	if (file == NULL && !preloaded_files_frozen)
+	{
+		file = (PreloadedFile*)malloc(sizeof(PreloadedFile));
+
+		if (file == NULL)
+			return NULL;
+
+		file->path = (char*)malloc(strlen(filename) + 1);
+
+		if (file->path == NULL)
+		{
+			free(file);
+			return NULL;
+		}
+
+		strcpy(file->path, filename);
+		file->data = NULL;
+		file->size = 0;
+
+		/* Files that fail to preload stay in the list too, so that they are not read in full again each time that they are opened. */
+		PreloadFileData(file);
+
+		file->next = preloaded_files;
+		preloaded_files = file;
+	}
+
+	return file != NULL && file->data != NULL ? file : NULL;
+}
+
+static void* ClownCDPreloadedFileOpen(const char* const filename, const ClownCD_FileMode mode)
+{
+	PreloadedStream* const stream = (PreloadedStream*)malloc(sizeof(PreloadedStream));
+
+	if (stream != NULL)
+	{
+		/* Only files that are read are preloaded. */
+		stream->file = mode == CLOWNCD_RB ? PreloadFile(filename) : NULL;
+		stream->handle = NULL;
+		stream->position = 0;
+
+		if (stream->file != NULL)
+			return stream;
+
+		stream->handle = ClownCDFileOpen(filename, mode);
+
+		if (stream->handle != NULL)
+			return stream;
+
+		free(stream);
+	}
+
+	return NULL;
+}
+
+static int ClownCDPreloadedFileClose(void* const stream_pointer)
+{
+	PreloadedStream* const stream = (PreloadedStream*)stream_pointer;
+	const int result = stream->file != NULL ? 0 : ClownCDFileClose(stream->handle);
+
+	/* The file itself stays in memory, as it is likely to be opened again. */
+	free(stream);
+
+	return result;
+}
+
+static size_t ClownCDPreloadedFileRead(void* const buffer, const size_t size, const size_t count, void* const stream_pointer)
+{
+	PreloadedStream* const stream = (PreloadedStream*)stream_pointer;
+	size_t total_read;
+
+	if (stream->file == NULL)
+		return ClownCDFileRead(buffer, size, count, stream->handle);
+
+	if (size == 0 || stream->position >= stream->file->size)
+		return 0;
+
+	total_read = CC_MIN(count, (stream->file->size - stream->position) / size);
+	memcpy(buffer, &stream->file->data[stream->position], total_read * size);
+	stream->position += total_read * size;
+
+	return total_read;
+}
+
+static size_t ClownCDPreloadedFileWrite(const void* const buffer, const size_t size, const size_t count, void* const stream_pointer)
+{
+	PreloadedStream* const stream = (PreloadedStream*)stream_pointer;
+
+	if (stream->file != NULL)
+		return 0;
+
+	return ClownCDFileWrite(buffer, size, count, stream->handle);
+}
+
+static long ClownCDPreloadedFileTell(void* const stream_pointer)
+{
+	PreloadedStream* const stream = (PreloadedStream*)stream_pointer;
+
+	if (stream->file == NULL)
+		return ClownCDFileTell(stream->handle);
+
+	if (stream->position > LONG_MAX)
+		return -1;
+
+	return (long)stream->position;
+}
+
+static int ClownCDPreloadedFileSeek(void* const stream_pointer, const long position, const ClownCD_FileOrigin origin)
+{
+	PreloadedStream* const stream = (PreloadedStream*)stream_pointer;
+	size_t base;
+
+	if (stream->file == NULL)
+		return ClownCDFileSeek(stream->handle, position, origin);
+
+	switch (origin)
+	{
+		case CLOWNCD_SEEK_SET:
+			base = 0;
+			break;
+
+		case CLOWNCD_SEEK_CUR:
+			base = stream->position;
+			break;
+
+		case CLOWNCD_SEEK_END:
+			base = stream->file->size;
+			break;
+
+		default:
+			return -1;
+	}
+
+	/* As with 'fseek', seeking past the end is allowed, but seeking before the start is not. */
+	if (position < 0 && (unsigned long)-(position + 1) >= base)
+		return -1;
+
+	stream->position = position < 0 ? base - (size_t)-(position + 1) - 1 : base + (size_t)position;
+
+	return 0;
+}
+
+const ClownCD_FileCallbacks clowncd_preloaded_callbacks = {
+	ClownCDPreloadedFileOpen,
+	ClownCDPreloadedFileClose,
+	ClownCDPreloadedFileRead,
+	ClownCDPreloadedFileWrite,
+	ClownCDPreloadedFileTell,
+	ClownCDPreloadedFileSeek
+};
+
+size_t ClownCDCallbacks_GetPreloadedSize(void)
+{
+	const PreloadedFile *file;
+	size_t total_size = 0;
+
+	for (file = preloaded_files; file != NULL; file = file->next)
+		total_size += file->size;
+
+	return total_size;
+}
+
+void ClownCDCallbacks_FreezePreloadedFiles(void)
+{
+	preloaded_files_frozen = cc_true;
+}
+
+void ClownCDCallbacks_FreePreloadedFiles(void)
+{
+	while (preloaded_files != NULL)
+	{
+		PreloadedFile* const next = preloaded_files->next;
+
+		free(preloaded_files->data);
+		free(preloaded_files->path);
+		free(preloaded_files);
+
+		preloaded_files = next;
+	}
+
+	preloaded_files_frozen = cc_false;
+}
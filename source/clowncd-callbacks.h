@@ -3,6 +3,23 @@
 
 #include "../common/clowncd/source/clowncd.h"
 
+/* Reads are served from a buffer that is refilled a block at a time, to reduce the number of calls to the VFS. */
 extern const ClownCD_FileCallbacks clowncd_callbacks;
 
+/* Sets the size of the blocks that files opened from then on are read in. Zero disables buffering.
+   Must not be called while files are being opened on other threads. */
+void ClownCDCallbacks_SetBlockSize(size_t size);
+
+/* Like 'clowncd_callbacks', but each file that is opened for reading is first loaded into memory in full, so that later reads
+   do not touch storage at all. Files remain in memory, and are shared by later opens, until they are freed.
+   Files that do not fit in memory are read from storage as usual. Only thread-safe once the files have been frozen. */
+extern const ClownCD_FileCallbacks clowncd_preloaded_callbacks;
+
+size_t ClownCDCallbacks_GetPreloadedSize(void);
+/* Stops any more files from being preloaded: from then on, files that were not preloaded are read from storage.
+   This makes 'clowncd_preloaded_callbacks' safe to use from several threads at once. */
+void ClownCDCallbacks_FreezePreloadedFiles(void);
+/* Must not be called while any files opened with 'clowncd_preloaded_callbacks' are still open. Unfreezes the files. */
+void ClownCDCallbacks_FreePreloadedFiles(void);
+
 #endif /* CLOWNCD_CALLBACKS_H */
@@ -0,0 +1,583 @@
+#include "disc-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clowncd-callbacks.h"
+#include "file-io.h"
+#include "worker-thread.h"
+
+#define DISC_CACHE_SECTOR_SIZE 2048
+/* How many sectors the worker decodes per job. */
+#define DISC_CACHE_CHUNK_SECTORS 0x40
+/* How many jobs are kept queued, so that the worker is never idle, but can be stopped quickly. */
+#define DISC_CACHE_QUEUED_CHUNKS 2
+#define DISC_CACHE_MAXIMUM_ENTRIES 0x100
+
+#define DISC_CACHE_INDEX_FILENAME "clownmdemu-disc-cache.txt"
+#define DISC_CACHE_FILENAME_PREFIX "clownmdemu-disc-cache-"
+#define DISC_CACHE_FILENAME_SUFFIX ".iso"
+
+/* The index of cached discs, which is kept as a text file alongside them. */
+typedef struct DiscCacheEntry
+{
+	char key[DISC_CACHE_KEY_LENGTH + 1];
+	unsigned long total_sectors;
+	unsigned long last_used; /* A timestamp, for evicting the least recently used discs. */
+} DiscCacheEntry;
+
+typedef struct DiscCacheIndex
+{
+	DiscCacheEntry entries[DISC_CACHE_MAXIMUM_ENTRIES];
+	size_t total_entries;
+} DiscCacheIndex;
+
+struct DiscCache
+{
+	/* Either the file is mapped into memory, or it is read through the VFS. */
+	const unsigned char *mapping;
+	size_t mapping_size;
+	struct retro_vfs_file_handle *file;
+	cc_u32f total_sectors;
+};
+
+struct DiscCacheBuilder
+{
+	WorkerThread *worker;
+	char *index_directory;
+	char *path;
+	char key[DISC_CACHE_KEY_LENGTH + 1];
+	cc_u32f total_sectors;
+	cc_u32f total_chunks;
+	cc_u32f submitted_chunks;
+	time_t start_time;
+	cc_bool finished;
+
+	/* Only accessed by the worker thread, or when no jobs are pending. */
+	CDReader_State reader;
+	struct retro_vfs_file_handle *file;
+	cc_u32f next_sector;
+	cc_bool failed;
+	cc_u16l sector[DISC_CACHE_SECTOR_SIZE / 2];
+	unsigned char buffer[DISC_CACHE_CHUNK_SECTORS * DISC_CACHE_SECTOR_SIZE];
+};
+
+/* Sectors are stored as bytes, in the order in which they appear on the disc. Each word holds two bytes, with the first in the upper half. */
+static void SectorWordsToBytes(unsigned char* const bytes, const cc_u16l* const words)
+{
+	size_t i;
+
+	for (i = 0; i < DISC_CACHE_SECTOR_SIZE / 2; ++i)
+	{
+		bytes[i * 2 + 0] = (words[i] >> 8) & 0xFF;
+		bytes[i * 2 + 1] = (words[i] >> 0) & 0xFF;
+	}
+}
+
+static void SectorBytesToWords(cc_u16l* const words, const unsigned char* const bytes)
+{
+	size_t i;
+
+	for (i = 0; i < DISC_CACHE_SECTOR_SIZE / 2; ++i)
+		words[i] = (cc_u16l)(bytes[i * 2 + 0] << 8 | bytes[i * 2 + 1]);
+}
+
+static char* MakePath(const char* const directory, const char* const key)
+{
+	/* A NULL key produces the path of the index. */
+	const size_t directory_length = strlen(directory);
+	char* const path = (char*)malloc(directory_length + 1 + sizeof(DISC_CACHE_FILENAME_PREFIX) + DISC_CACHE_KEY_LENGTH + sizeof(DISC_CACHE_FILENAME_SUFFIX) + sizeof(DISC_CACHE_INDEX_FILENAME));
+
+	if (path != NULL)
+	{
+		memcpy(path, directory, directory_length);
+		path[directory_length] = '/';
+
+		if (key == NULL)
+			strcpy(&path[directory_length + 1], DISC_CACHE_INDEX_FILENAME);
+		else
+			sprintf(&path[directory_length + 1], DISC_CACHE_FILENAME_PREFIX "%s" DISC_CACHE_FILENAME_SUFFIX, key);
+	}
+
+	return path;
+}
+
+static void LoadIndex(DiscCacheIndex* const index, const char* const directory)
+{
+	char* const path = MakePath(directory, NULL);
+	unsigned char *file_buffer;
+	size_t file_size;
+
+	index->total_entries = 0;
+
+	if (path != NULL && LoadFileToBuffer(path, &file_buffer, &file_size, NULL))
+	{
+		/* Each line is a key, a sector count, and a timestamp. */
+		char* const text = (char*)realloc(file_buffer, file_size + 1);
+
+		if (text == NULL)
+		{
+			free(file_buffer);
+		}
+		else
+		{
+			const char *line = text;
+
+			text[file_size] = '\0';
+
+			while (*line != '\0' && index->total_entries < DISC_CACHE_MAXIMUM_ENTRIES)
+			{
+				DiscCacheEntry* const entry = &index->entries[index->total_entries];
+				const char* const line_end = strchr(line, '\n');
+
+				if (sscanf(line, "%40s %lu %lu", entry->key, &entry->total_sectors, &entry->last_used) == 3 && strlen(entry->key) == DISC_CACHE_KEY_LENGTH)
+					++index->total_entries;
+
+				if (line_end == NULL)
+					break;
+
+				line = line_end + 1;
+			}
+
+			free(text);
+		}
+	}
+
+	free(path);
+}
+
+static void SaveIndex(const DiscCacheIndex* const index, const char* const directory)
+{
+	char* const path = MakePath(directory, NULL);
+
+	if (path != NULL)
+	{
+		struct retro_vfs_file_handle* const file = file_io.open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+		if (file != NULL)
+		{
+			size_t i;
+
+			for (i = 0; i < index->total_entries; ++i)
+			{
+				const DiscCacheEntry* const entry = &index->entries[i];
+				char line[DISC_CACHE_KEY_LENGTH + 2 * 21 + 4];
+
+				sprintf(line, "%s %lu %lu\n", entry->key, entry->total_sectors, entry->last_used);
+				file_io.write(file, line, strlen(line));
+			}
+
+			file_io.close(file);
+		}
+
+		free(path);
+	}
+}
+
+static DiscCacheEntry* FindEntry(DiscCacheIndex* const index, const char* const key)
+{
+	size_t i;
+
+	for (i = 0; i < index->total_entries; ++i)
+		if (strcmp(index->entries[i].key, key) == 0)
+			return &index->entries[i];
+
+	return NULL;
+}
+
+static void RemoveEntry(DiscCacheIndex* const index, DiscCacheEntry* const entry, const char* const directory)
+{
+	char* const path = MakePath(directory, entry->key);
+
+	if (path != NULL)
+	{
+		file_io.remove(path);
+		free(path);
+	}
+
+	*entry = index->entries[--index->total_entries];
+}
+
+static unsigned long GetSizeInMebibytes(const unsigned long total_sectors)
+{
+	return (total_sectors + (1024 * 1024 / DISC_CACHE_SECTOR_SIZE) - 1) / (1024 * 1024 / DISC_CACHE_SECTOR_SIZE);
+}
+
+static void ReadDiscCacheChunk(void* const user_data, const cc_u16f job)
+{
+	DiscCacheBuilder* const builder = (DiscCacheBuilder*)user_data;
+	const cc_u32f total_sectors = CC_MIN(DISC_CACHE_CHUNK_SECTORS, builder->total_sectors - builder->next_sector);
+	cc_u32f i;
+
+	(void)job;
+
+	if (builder->failed)
+		return;
+
+	for (i = 0; i < total_sectors; ++i)
+	{
+		CDReader_ReadSector(&builder->reader, builder->sector);
+		SectorWordsToBytes(&builder->buffer[i * DISC_CACHE_SECTOR_SIZE], builder->sector);
+	}
+
+	if (file_io.write(builder->file, builder->buffer, total_sectors * DISC_CACHE_SECTOR_SIZE) != (int64_t)(total_sectors * DISC_CACHE_SECTOR_SIZE))
+		builder->failed = cc_true;
+
+	builder->next_sector += total_sectors;
+}
+
+static cc_bool ReadCHDSHA1(const char* const chd_path, unsigned char sha1[20])
+{
+	/* The SHA-1 of the whole disc's data and metadata, which every CHD records in its header. Its offset depends on the header's version. */
+	static const unsigned char tag[8] = {'M', 'C', 'o', 'm', 'p', 'r', 'H', 'D'};
+	struct retro_vfs_file_handle* const file = file_io.open(chd_path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+	unsigned char header[124];
+	cc_bool success = cc_false;
+
+	if (file != NULL)
+	{
+		if (file_io.read(file, header, sizeof(header)) == (int64_t)sizeof(header) && memcmp(header, tag, sizeof(tag)) == 0)
+		{
+			const unsigned long version = (unsigned long)header[12] << 24 | (unsigned long)header[13] << 16 | (unsigned long)header[14] << 8 | (unsigned long)header[15];
+			size_t offset = 0;
+
+			switch (version)
+			{
+				case 3:
+					offset = 80;
+					break;
+
+				case 4:
+					offset = 48;
+					break;
+
+				case 5:
+					offset = 84;
+					break;
+			}
+
+			if (offset != 0)
+			{
+				memcpy(sha1, &header[offset], 20);
+				success = cc_true;
+			}
+		}
+
+		file_io.close(file);
+	}
+
+	return success;
+}
+
+cc_bool DiscCache_ComputeKey(CDReader_State* const reader, const char* const chd_path, char key[DISC_CACHE_KEY_LENGTH + 1], cc_u32f* const total_sectors)
+{
+	cc_u16l words[DISC_CACHE_SECTOR_SIZE / 2];
+	unsigned char bytes[DISC_CACHE_SECTOR_SIZE];
+	unsigned char sha1[20];
+	size_t i;
+
+	if (!ReadCHDSHA1(chd_path, sha1))
+		return cc_false;
+
+	/* Sector 16 is the primary volume descriptor, which holds the size of the file system in little-endian and big-endian. */
+	if (!CDReader_SeekToSector(reader, 16))
+		return cc_false;
+
+	CDReader_ReadSector(reader, words);
+	SectorWordsToBytes(bytes, words);
+
+	if (bytes[0] != 1 || memcmp(&bytes[1], "CD001", 5) != 0)
+		return cc_false;
+
+	*total_sectors = (cc_u32f)bytes[80] << 0 | (cc_u32f)bytes[81] << 8 | (cc_u32f)bytes[82] << 16 | (cc_u32f)bytes[83] << 24;
+
+	if (*total_sectors == 0)
+		return cc_false;
+
+	for (i = 0; i < sizeof(sha1); ++i)
+		sprintf(&key[i * 2], "%02X", sha1[i]);
+
+	return cc_true;
+}
+
+DiscCache* DiscCache_Open(const char* const directory, const char* const key, const cc_u32f total_sectors)
+{
+	DiscCacheIndex* const index = (DiscCacheIndex*)malloc(sizeof(DiscCacheIndex));
+	DiscCache *cache = NULL;
+
+	if (index != NULL)
+	{
+		DiscCacheEntry *entry;
+
+		LoadIndex(index, directory);
+		entry = FindEntry(index, key);
+
+		if (entry != NULL && entry->total_sectors == total_sectors)
+		{
+			char* const path = MakePath(directory, key);
+
+			cache = (DiscCache*)calloc(1, sizeof(DiscCache));
+
+			if (path != NULL && cache != NULL)
+			{
+				const size_t expected_size = (size_t)total_sectors * DISC_CACHE_SECTOR_SIZE;
+
+				cache->total_sectors = total_sectors;
+				cache->mapping = MapFileToMemory(path, &cache->mapping_size);
+
+				if (cache->mapping != NULL && cache->mapping_size != expected_size)
+				{
+					UnmapFileFromMemory(cache->mapping, cache->mapping_size);
+					cache->mapping = NULL;
+				}
+
+				/* Fall back on reading through the VFS. */
+				if (cache->mapping == NULL)
+				{
+					cache->file = file_io.open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS);
+
+					if (cache->file != NULL && file_io.get_size(cache->file) != (int64_t)expected_size)
+					{
+						file_io.close(cache->file);
+						cache->file = NULL;
+					}
+				}
+
+				if (cache->mapping == NULL && cache->file == NULL)
+				{
+					/* The file is missing or damaged, so forget about it. */
+					RemoveEntry(index, entry, directory);
+					free(cache);
+					cache = NULL;
+				}
+				else
+				{
+					entry->last_used = (unsigned long)time(NULL);
+					libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: using '%s'%s.\n", path, cache->mapping != NULL ? ", memory-mapped" : "");
+				}
+
+				SaveIndex(index, directory);
+			}
+			else
+			{
+				free(cache);
+				cache = NULL;
+			}
+
+			free(path);
+		}
+
+		free(index);
+	}
+
+	return cache;
+}
+
+void DiscCache_Close(DiscCache* const cache)
+{
+	if (cache->mapping != NULL)
+		UnmapFileFromMemory(cache->mapping, cache->mapping_size);
+
+	if (cache->file != NULL)
+		file_io.close(cache->file);
+
+	free(cache);
+}
+
+cc_bool DiscCache_ReadSector(DiscCache* const cache, const cc_u32f sector_index, cc_u16l* const buffer)
+{
+	if (sector_index >= cache->total_sectors)
+		return cc_false;
+
+	if (cache->mapping != NULL)
+	{
+		SectorBytesToWords(buffer, &cache->mapping[(size_t)sector_index * DISC_CACHE_SECTOR_SIZE]);
+	}
+	else
+	{
+		unsigned char bytes[DISC_CACHE_SECTOR_SIZE];
+
+		if (file_io.seek(cache->file, (int64_t)sector_index * DISC_CACHE_SECTOR_SIZE, RETRO_VFS_SEEK_POSITION_START) == -1
+		 || file_io.read(cache->file, bytes, sizeof(bytes)) != (int64_t)sizeof(bytes))
+			return cc_false;
+
+		SectorBytesToWords(buffer, bytes);
+	}
+
+	return cc_true;
+}
+
+DiscCacheBuilder* DiscCacheBuilder_Create(const char* const directory, const char* const key, const char* const disc_path, const cc_u32f total_sectors, const unsigned long size_limit_in_mebibytes)
+{
+	const unsigned long size_in_mebibytes = GetSizeInMebibytes(total_sectors);
+	DiscCacheBuilder *builder;
+	DiscCacheIndex *index;
+
+	if (size_in_mebibytes > size_limit_in_mebibytes || (uint64_t)total_sectors * DISC_CACHE_SECTOR_SIZE > (size_t)-1)
+	{
+		libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: disc is too large to cache (%luMiB).\n", size_in_mebibytes);
+		return NULL;
+	}
+
+	builder = (DiscCacheBuilder*)calloc(1, sizeof(DiscCacheBuilder));
+	index = (DiscCacheIndex*)malloc(sizeof(DiscCacheIndex));
+
+	if (builder != NULL && index != NULL)
+	{
+		builder->index_directory = (char*)malloc(strlen(directory) + 1);
+		builder->path = MakePath(directory, key);
+
+		if (builder->index_directory != NULL && builder->path != NULL)
+		{
+			unsigned long used_mebibytes = 0;
+			DiscCacheEntry *entry;
+			size_t i;
+
+			strcpy(builder->index_directory, directory);
+			strcpy(builder->key, key);
+			builder->total_sectors = total_sectors;
+			builder->total_chunks = (total_sectors + DISC_CACHE_CHUNK_SECTORS - 1) / DISC_CACHE_CHUNK_SECTORS;
+
+			/* Evict the least recently used discs until there is room for this one. */
+			LoadIndex(index, directory);
+
+			entry = FindEntry(index, key);
+
+			if (entry != NULL)
+				RemoveEntry(index, entry, directory);
+
+			for (i = 0; i < index->total_entries; ++i)
+				used_mebibytes += GetSizeInMebibytes(index->entries[i].total_sectors);
+
+			while (index->total_entries != 0 && (used_mebibytes + size_in_mebibytes > size_limit_in_mebibytes || index->total_entries == DISC_CACHE_MAXIMUM_ENTRIES))
+			{
+				DiscCacheEntry *oldest_entry = &index->entries[0];
+
+				for (i = 1; i < index->total_entries; ++i)
+					if (index->entries[i].last_used < oldest_entry->last_used)
+						oldest_entry = &index->entries[i];
+
+				libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: evicting '%s'.\n", oldest_entry->key);
+
+				used_mebibytes -= GetSizeInMebibytes(oldest_entry->total_sectors);
+				RemoveEntry(index, oldest_entry, directory);
+			}
+
+			SaveIndex(index, directory);
+
+			builder->file = file_io.open(builder->path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+			if (builder->file != NULL)
+			{
+				CDReader_Initialise(&builder->reader);
+				CDReader_Open(&builder->reader, NULL, disc_path, &clowncd_callbacks);
+
+				if (CDReader_IsOpen(&builder->reader) && CDReader_SeekToSector(&builder->reader, 0))
+				{
+					builder->worker = WorkerThread_Create(ReadDiscCacheChunk, builder);
+
+					if (builder->worker != NULL)
+					{
+						builder->start_time = time(NULL);
+						libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: decoding %luMiB to '%s'.\n", size_in_mebibytes, builder->path);
+
+						free(index);
+						return builder;
+					}
+				}
+
+				CDReader_Close(&builder->reader);
+				CDReader_Deinitialise(&builder->reader);
+
+				file_io.close(builder->file);
+				file_io.remove(builder->path);
+			}
+		}
+
+		free(builder->path);
+		free(builder->index_directory);
+	}
+
+	free(index);
+	free(builder);
+
+	return NULL;
+}
+
+void DiscCacheBuilder_Destroy(DiscCacheBuilder* const builder)
+{
+	WorkerThread_Destroy(builder->worker);
+
+	if (!builder->finished)
+	{
+		libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: decoding was interrupted after %lu of %lu sectors.\n", (unsigned long)builder->next_sector, (unsigned long)builder->total_sectors);
+
+		file_io.close(builder->file);
+		file_io.remove(builder->path);
+	}
+
+	CDReader_Close(&builder->reader);
+	CDReader_Deinitialise(&builder->reader);
+
+	free(builder->path);
+	free(builder->index_directory);
+	free(builder);
+}
+
+cc_bool DiscCacheBuilder_Update(DiscCacheBuilder* const builder)
+{
+	if (builder->finished)
+		return cc_true;
+
+	if (builder->submitted_chunks != builder->total_chunks)
+	{
+		while (builder->submitted_chunks != builder->total_chunks && WorkerThread_GetPendingJobs(builder->worker) < DISC_CACHE_QUEUED_CHUNKS)
+		{
+			WorkerThread_Submit(builder->worker, 0);
+			++builder->submitted_chunks;
+		}
+	}
+	else if (WorkerThread_GetPendingJobs(builder->worker) == 0)
+	{
+		/* Make the worker's writes visible. */
+		WorkerThread_Finish(builder->worker);
+
+		file_io.close(builder->file);
+		builder->file = NULL;
+		builder->finished = cc_true;
+
+		if (builder->failed)
+		{
+			libretro_callbacks.log(RETRO_LOG_WARN, "Disc cache: could not write '%s'.\n", builder->path);
+			file_io.remove(builder->path);
+		}
+		else
+		{
+			DiscCacheIndex* const index = (DiscCacheIndex*)malloc(sizeof(DiscCacheIndex));
+
+			if (index != NULL)
+			{
+				LoadIndex(index, builder->index_directory);
+
+				if (index->total_entries != DISC_CACHE_MAXIMUM_ENTRIES)
+				{
+					DiscCacheEntry* const entry = &index->entries[index->total_entries++];
+
+					strcpy(entry->key, builder->key);
+					entry->total_sectors = builder->total_sectors;
+					entry->last_used = (unsigned long)time(NULL);
+
+					SaveIndex(index, builder->index_directory);
+
+					libretro_callbacks.log(RETRO_LOG_INFO, "Disc cache: finished decoding in %lus. The cache will be used from the next time that this disc is loaded.\n", (unsigned long)difftime(time(NULL), builder->start_time));
+				}
+
+				free(index);
+			}
+		}
+	}
+
+	return builder->finished;
+}
@@ -0,0 +1,36 @@
+#ifndef DISC_CACHE_H
+#define DISC_CACHE_H
+
+#include <stddef.h>
+
+#include "../common/cd-reader.h"
+
+#include "libretro-interface.h"
+
+/* Keys are SHA-1 hashes, written as hexadecimal. */
+#define DISC_CACHE_KEY_LENGTH 40
+
+typedef struct DiscCache DiscCache;
+typedef struct DiscCacheBuilder DiscCacheBuilder;
+
+/* Identifies a disc by its content rather than by its path, using the SHA-1 of the whole disc that is stored in the CHD's header.
+   Also obtains the size of its data track from the reader. Returns cc_false if the file is not a CHD, or if the disc does not have
+   an ISO 9660 file system. The reader is left at an unspecified sector. */
+cc_bool DiscCache_ComputeKey(CDReader_State *reader, const char *chd_path, char key[DISC_CACHE_KEY_LENGTH + 1], cc_u32f *total_sectors);
+
+/* A decoded copy of a disc's data track, stored as a flat file of 2048-byte sectors in the given directory.
+   The file is memory-mapped where possible. Returns NULL if the disc is not in the cache. */
+DiscCache* DiscCache_Open(const char *directory, const char *key, cc_u32f total_sectors);
+void DiscCache_Close(DiscCache *cache);
+/* Returns cc_false if the sector is beyond the end of the data track, or could not be read. */
+cc_bool DiscCache_ReadSector(DiscCache *cache, cc_u32f sector_index, cc_u16l *buffer);
+
+/* Adds a disc to the cache by decoding it on a worker thread, evicting the least recently used discs to stay within
+   the size limit. Returns NULL if threads are unavailable, or if the disc is too large or could not be opened. */
+DiscCacheBuilder* DiscCacheBuilder_Create(const char *directory, const char *key, const char *disc_path, cc_u32f total_sectors, unsigned long size_limit_in_mebibytes);
+/* Abandons the disc if it has not been fully decoded yet. */
+void DiscCacheBuilder_Destroy(DiscCacheBuilder *builder);
+/* Must be called regularly to keep the worker busy. Returns cc_true once the disc has been added to the cache, or has failed to be. */
+cc_bool DiscCacheBuilder_Update(DiscCacheBuilder *builder);
+
+#endif /* DISC_CACHE_H */
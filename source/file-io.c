@@ -1,10 +1,38 @@
 #include "file-io.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+	#include <unistd.h>
+
+	#if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+		#define FILE_IO_POSIX
+
+		#include <fcntl.h>
+		#include <sys/stat.h>
+		#include <sys/types.h>
+	#endif
+
+	#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+		#define FILE_IO_MMAP
+
+		#include <fcntl.h>
+		#include <sys/mman.h>
+		#include <sys/stat.h>
+	#endif
+#endif
+
 FileFunctions file_io;
 
+/* Set when the frontend has no VFS, so files are accessed directly and may be memory-mapped. */
+static bool file_io_is_native;
+
+/* Only provided by version 3 and later of the frontend's VFS. */
+static retro_vfs_stat_t file_io_stat;
+
+#ifndef FILE_IO_POSIX
 static struct retro_vfs_file_handle* RETRO_CALLCONV File_OpenDefault(const char* const path, const unsigned int mode, const unsigned int hints)
 {
 	const char* mode_standard;
@@ -117,11 +145,203 @@ static int64_t RETRO_CALLCONV File_WriteDefault(struct retro_vfs_file_handle* co
 	return fwrite(s, 1, len, (FILE*)stream);
 }
 
+#endif
+
 static int RETRO_CALLCONV File_RemoveDefault(const char* const path)
 {
 	return remove(path);
 }
 
+#ifdef FILE_IO_POSIX
+/* Unlike stdio, these do not buffer, use 64-bit offsets even where 'long' is 32-bit, and do not need to seek to find the size of a file.
+   Reads and writes are positional, so the file descriptor's own offset is never used. */
+
+typedef struct FilePOSIX
+{
+	int descriptor;
+	int64_t position;
+} FilePOSIX;
+
+static cc_bool ToOffset(const int64_t position, off_t* const offset)
+{
+	/* 'off_t' may only be 32-bit if large file support was not enabled. */
+	*offset = (off_t)position;
+	return *offset == position;
+}
+
+static struct retro_vfs_file_handle* RETRO_CALLCONV File_OpenPOSIX(const char* const path, const unsigned int mode, const unsigned int hints)
+{
+	FilePOSIX *file;
+	int flags;
+
+	(void)hints;
+
+	switch (mode)
+	{
+		case RETRO_VFS_FILE_ACCESS_READ:
+		case RETRO_VFS_FILE_ACCESS_READ | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING:
+			flags = O_RDONLY;
+			break;
+
+		case RETRO_VFS_FILE_ACCESS_WRITE:
+			flags = O_WRONLY | O_CREAT | O_TRUNC;
+			break;
+
+		case RETRO_VFS_FILE_ACCESS_WRITE | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING:
+		case RETRO_VFS_FILE_ACCESS_READ | RETRO_VFS_FILE_ACCESS_WRITE | RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING:
+			flags = O_RDWR;
+			break;
+
+		case RETRO_VFS_FILE_ACCESS_READ | RETRO_VFS_FILE_ACCESS_WRITE:
+			flags = O_RDWR | O_CREAT | O_TRUNC;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	file = (FilePOSIX*)malloc(sizeof(FilePOSIX));
+
+	if (file != NULL)
+	{
+		file->descriptor = open(path, flags, 0666);
+		file->position = 0;
+
+		if (file->descriptor != -1)
+			return (struct retro_vfs_file_handle*)file;
+
+		free(file);
+	}
+
+	return NULL;
+}
+
+static int RETRO_CALLCONV File_ClosePOSIX(struct retro_vfs_file_handle* const stream)
+{
+	FilePOSIX* const file = (FilePOSIX*)stream;
+	int result;
+
+	if (file == NULL)
+		return -1;
+
+	result = close(file->descriptor) == 0 ? 0 : -1;
+	free(file);
+
+	return result;
+}
+
+static int64_t RETRO_CALLCONV File_GetSizePOSIX(struct retro_vfs_file_handle* const stream)
+{
+	FilePOSIX* const file = (FilePOSIX*)stream;
+	struct stat status;
+
+	if (fstat(file->descriptor, &status) != 0)
+		return -1;
+
+	return status.st_size;
+}
+
+static int64_t RETRO_CALLCONV File_TellPOSIX(struct retro_vfs_file_handle* const stream)
+{
+	return ((FilePOSIX*)stream)->position;
+}
+
+static int64_t RETRO_CALLCONV File_SeekPOSIX(struct retro_vfs_file_handle* const stream, const int64_t offset, const int seek_position)
+{
+	FilePOSIX* const file = (FilePOSIX*)stream;
+	int64_t base;
+
+	switch (seek_position)
+	{
+		case RETRO_VFS_SEEK_POSITION_START:
+			base = 0;
+			break;
+
+		case RETRO_VFS_SEEK_POSITION_CURRENT:
+			base = file->position;
+			break;
+
+		case RETRO_VFS_SEEK_POSITION_END:
+			base = File_GetSizePOSIX(stream);
+
+			if (base < 0)
+				return -1;
+
+			break;
+
+		default:
+			return -1;
+	}
+
+	if (offset < -base)
+		return -1;
+
+	file->position = base + offset;
+
+	return file->position;
+}
+
+static int64_t RETRO_CALLCONV File_ReadPOSIX(struct retro_vfs_file_handle* const stream, void* const s, const uint64_t len)
+{
+	FilePOSIX* const file = (FilePOSIX*)stream;
+	unsigned char *buffer = (unsigned char*)s;
+	uint64_t remaining = len;
+
+	/* 'pread' may read less than was asked for, even before the end of the file. */
+	while (remaining != 0)
+	{
+		const size_t chunk_size = (size_t)CC_MIN(remaining, 0x40000000);
+		off_t offset;
+		ssize_t total_read;
+
+		if (!ToOffset(file->position, &offset))
+			return -1;
+
+		total_read = pread(file->descriptor, buffer, chunk_size, offset);
+
+		if (total_read < 0)
+			return -1;
+
+		if (total_read == 0)
+			break;
+
+		buffer += total_read;
+		remaining -= total_read;
+		file->position += total_read;
+	}
+
+	return len - remaining;
+}
+
+static int64_t RETRO_CALLCONV File_WritePOSIX(struct retro_vfs_file_handle* const stream, const void* const s, const uint64_t len)
+{
+	FilePOSIX* const file = (FilePOSIX*)stream;
+	const unsigned char *buffer = (const unsigned char*)s;
+	uint64_t remaining = len;
+
+	while (remaining != 0)
+	{
+		const size_t chunk_size = (size_t)CC_MIN(remaining, 0x40000000);
+		off_t offset;
+		ssize_t total_written;
+
+		if (!ToOffset(file->position, &offset))
+			return -1;
+
+		total_written = pwrite(file->descriptor, buffer, chunk_size, offset);
+
+		if (total_written <= 0)
+			return -1;
+
+		buffer += total_written;
+		remaining -= total_written;
+		file->position += total_written;
+	}
+
+	return len;
+}
+#endif
+
 void LoadFileIOCallbacks(void)
 {
 	struct retro_vfs_interface_info info;
@@ -138,9 +358,24 @@ void LoadFileIOCallbacks(void)
 		file_io.read     = info.iface->read;
 		file_io.write    = info.iface->write;
 		file_io.remove   = info.iface->remove;
+
+		/* The frontend reports the version that it actually provides, which may be newer than the one that was asked for. */
+		file_io_stat = info.required_interface_version >= 3 ? info.iface->stat : NULL;
+
+		file_io_is_native = false;
 	}
 	else
 	{
+#ifdef FILE_IO_POSIX
+		file_io.open     = File_OpenPOSIX;
+		file_io.close    = File_ClosePOSIX;
+		file_io.get_size = File_GetSizePOSIX;
+		file_io.tell     = File_TellPOSIX;
+		file_io.seek     = File_SeekPOSIX;
+		file_io.read     = File_ReadPOSIX;
+		file_io.write    = File_WritePOSIX;
+		file_io.remove   = File_RemoveDefault;
+#else
 		file_io.open     = File_OpenDefault;
 		file_io.close    = File_CloseDefault;
 		file_io.get_size = File_GetSizeDefault;
@@ -149,13 +384,69 @@ void LoadFileIOCallbacks(void)
 		file_io.read     = File_ReadDefault;
 		file_io.write    = File_WriteDefault;
 		file_io.remove   = File_RemoveDefault;
+#endif
+
+		file_io_is_native = true;
+	}
+}
+
+static unsigned char* MapFilePrivately(const char* const path, size_t* const size)
+{
+#ifdef FILE_IO_MMAP
+	unsigned char *data = NULL;
+	const int file = open(path, O_RDONLY);
+
+	if (file != -1)
+	{
+		struct stat status;
+
+		if (fstat(file, &status) == 0 && status.st_size > 0 && (uint64_t)status.st_size <= (size_t)-1)
+		{
+			/* Pages are only copied if they are written to, and changes never reach the file. */
+			void* const mapping = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+			if (mapping != MAP_FAILED)
+			{
+				data = (unsigned char*)mapping;
+				*size = (size_t)status.st_size;
+			}
+		}
+
+		close(file);
 	}
+
+	return data;
+#else
+	(void)path;
+	(void)size;
+
+	return NULL;
+#endif
 }
 
-bool LoadFileToBuffer(const char* const path, unsigned char** const output_file_buffer, size_t* const output_file_size)
+bool LoadFileToBuffer(const char* const path, unsigned char** const output_file_buffer, size_t* const output_file_size, bool* const output_is_mapped)
 {
 	bool success = false;
-	struct retro_vfs_file_handle* const file = file_io.open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+	struct retro_vfs_file_handle *file;
+
+	if (output_is_mapped != NULL)
+	{
+		*output_is_mapped = false;
+
+		/* Mapping bypasses the VFS, so it is only done when there is no VFS to bypass. */
+		if (file_io_is_native)
+		{
+			*output_file_buffer = MapFilePrivately(path, output_file_size);
+
+			if (*output_file_buffer != NULL)
+			{
+				*output_is_mapped = true;
+				return true;
+			}
+		}
+	}
+
+	file = file_io.open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
 
 	if (file != NULL)
 	{
@@ -189,3 +480,76 @@ bool LoadFileToBuffer(const char* const path, unsigned char** const output_file_
 	return success;
 }
 
+bool FileIsMissing(const char* const path)
+{
+	if (!file_io_is_native)
+	{
+		int32_t size;
+
+		return file_io_stat != NULL && (file_io_stat(path, &size) & RETRO_VFS_STAT_IS_VALID) == 0;
+	}
+	else
+	{
+#ifdef FILE_IO_POSIX
+		struct stat status;
+
+		return stat(path, &status) != 0 && errno == ENOENT;
+#else
+		(void)path;
+
+		return false;
+#endif
+	}
+}
+
+void FreeFileBuffer(unsigned char* const buffer, const size_t size, const bool is_mapped)
+{
+	if (is_mapped)
+		UnmapFileFromMemory(buffer, size);
+	else
+		free(buffer);
+}
+
+const unsigned char* MapFileToMemory(const char* const path, size_t* const size)
+{
+#ifdef FILE_IO_MMAP
+	const unsigned char *data = NULL;
+	const int file = open(path, O_RDONLY);
+
+	if (file != -1)
+	{
+		struct stat status;
+
+		if (fstat(file, &status) == 0 && status.st_size > 0 && (uint64_t)status.st_size <= (size_t)-1)
+		{
+			void* const mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, file, 0);
+
+			if (mapping != MAP_FAILED)
+			{
+				data = (const unsigned char*)mapping;
+				*size = (size_t)status.st_size;
+			}
+		}
+
+		/* The mapping remains valid after the file is closed. */
+		close(file);
+	}
+
+	return data;
+#else
+	(void)path;
+	(void)size;
+
+	return NULL;
+#endif
+}
+
+void UnmapFileFromMemory(const unsigned char* const data, const size_t size)
+{
+#ifdef FILE_IO_MMAP
+	munmap((void*)data, size);
+#else
+	(void)data;
+	(void)size;
+#endif
+}
@@ -21,6 +21,17 @@ extern FileFunctions file_io;
 
 void LoadFileIOCallbacks(void);
 
-bool LoadFileToBuffer(const char* const path, unsigned char** const output_file_buffer, size_t* const output_file_size);
+/* If 'output_is_mapped' is not NULL, then the file may be memory-mapped instead of copied, when the frontend has no VFS.
+   Either way, the buffer belongs to the caller and may be modified, but must be released with 'FreeFileBuffer'. */
+bool LoadFileToBuffer(const char* const path, unsigned char** const output_file_buffer, size_t* const output_file_size, bool* const output_is_mapped);
+void FreeFileBuffer(unsigned char *buffer, size_t size, bool is_mapped);
+
+/* Returns true only if the file is known to not exist, rather than merely failing to open. If that cannot be told, returns false. */
+bool FileIsMissing(const char *path);
+
+/* Maps a whole file into memory for reading, bypassing the frontend's VFS, so it is only suitable for files that the core
+   creates itself. Returns NULL if the file could not be mapped, or if the platform does not support memory-mapping. */
+const unsigned char* MapFileToMemory(const char *path, size_t *size);
+void UnmapFileFromMemory(const unsigned char *data, size_t size);
 
 #endif /* FILE_IO_H */
@@ -3,9 +3,11 @@
 #include <assert.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "libretro.h"
 #include "retro_endianness.h"
@@ -17,9 +19,15 @@
 #define MIXER_IMPLEMENTATION
 #include "../common/mixer.h"
 
+#include "cd-read-ahead.h"
+#include "cdda-decode-ahead.h"
 #include "clowncd-callbacks.h"
+#include "disc-cache.h"
 #include "file-io.h"
 #include "options.h"
+#include "pixel-conversion.h"
+#include "rewind.h"
+#include "worker-thread.h"
 
 #define FRAMEBUFFER_WIDTH VDP_MAX_SCANLINE_WIDTH
 #define FRAMEBUFFER_HEIGHT VDP_MAX_SCANLINES
@@ -41,30 +49,280 @@ static union
 	uint32_t u32[FRAMEBUFFER_HEIGHT][FRAMEBUFFER_WIDTH];
 } fallback_framebuffer;
 
-static union
-{
-	uint16_t u16[16 * 4 * 3]; /* 16 colours, 4 palette lines, 3 brightnesses. */
-	uint32_t u32[16 * 4 * 3];
-} colours;
+static PixelConversion_Palette colours;
+static const PixelConversion_Kernel *pixel_conversion_kernel;
+static cc_bool pixel_conversion_benchmark_enabled;
 
 static void *current_framebuffer;
 static size_t current_framebuffer_pitch;
-static void (*scanline_rendered_callback)(void *user_data, const cc_u8l *source_pixels, void *destination_pixels, cc_u16f left_boundary, cc_u16f right_boundary);
+static void (*convert_scanline)(const PixelConversion_Palette *palette, const cc_u8l *source_pixels, void *destination_pixels, cc_u16f left_boundary, cc_u16f right_boundary);
 static void (*fallback_colour_updated_callback)(void *user_data, cc_u16f index, cc_u16f colour);
-static void (*fallback_scanline_rendered_callback)(void *user_data, const cc_u8l *source_pixels, void *destination_pixels, cc_u16f left_boundary, cc_u16f right_boundary);
+static void (*fallback_convert_scanline)(const PixelConversion_Palette *palette, const cc_u8l *source_pixels, void *destination_pixels, cc_u16f left_boundary, cc_u16f right_boundary);
+
+typedef enum ColourConversionMode
+{
+	COLOUR_CONVERSION_MODE_SCANLINE,
+	COLOUR_CONVERSION_MODE_FRAME,
+	COLOUR_CONVERSION_MODE_THREADED
+} ColourConversionMode;
+
+static ColourConversionMode colour_conversion_mode;
+
+/* Converts deferred scanlines while the emulator carries on with the rest of the frame. */
+static struct
+{
+	WorkerThread *worker;
+	retro_time_t busy_time; /* Written by the worker thread, so must only be accessed after 'WorkerThread_Finish'. */
+	retro_time_t time_saved;
+	cc_u16f total_frames;
+} conversion_thread;
+
+/* The indexed pixels of the current frame, for when colour conversion is deferred until the frame is complete.
+   A copy of the palette is made for each scanline that follows a change to it. */
+static struct
+{
+	cc_u8l pixels[FRAMEBUFFER_HEIGHT][FRAMEBUFFER_WIDTH];
+	struct
+	{
+		cc_u16l left_boundary;
+		cc_u16l right_boundary;
+		cc_u16l palette_index;
+		cc_bool pending;
+	} scanlines[FRAMEBUFFER_HEIGHT];
+	PixelConversion_Palette palettes[FRAMEBUFFER_HEIGHT];
+	cc_u16f total_palettes;
+	cc_bool palette_changed;
+	cc_bool frame_changed; /* Since the last frame that was uploaded to the frontend. */
+} indexed_frame;
+
+static cc_bool frontend_can_dupe;
+static cc_bool duplicate_frames_allowed;
+
+/* Work that is skipped for the current frame because its output would go unused.
+   This only affects what is sent to the frontend: the emulated state is the same either way. */
+static struct
+{
+	cc_bool skip_video;
+	cc_bool skip_audio;
+	cc_bool mixer_in_use;
+	cc_s16l *discarded_samples;
+	size_t discarded_samples_capacity;
+} frame_output;
+
+typedef enum FrameskipMode
+{
+	FRAMESKIP_MODE_DISABLED,
+	FRAMESKIP_MODE_AUTO,      /* Skip when the frontend reports that audio is about to underrun. */
+	FRAMESKIP_MODE_THRESHOLD, /* Skip when the frontend's audio buffer is less full than the threshold. */
+	FRAMESKIP_MODE_FIXED      /* Skip the same number of frames after every rendered one. */
+} FrameskipMode;
+
+static struct
+{
+	FrameskipMode mode;
+	cc_u8f threshold;
+	cc_u8f interval; /* The number of frames to skip in fixed mode, or the most that may be skipped in a row otherwise. */
+	cc_u8f frames_skipped;
+	cc_bool callback_registered;
+
+	/* Reported by the frontend. */
+	cc_bool audio_buffer_active;
+	cc_u8f audio_buffer_occupancy;
+	cc_bool audio_buffer_underrun_likely;
+} frameskip;
+
+/* While the frontend is fast-forwarding, accuracy is traded for speed. */
+static struct
+{
+	cc_bool enabled;
+	cc_bool active;
+	cc_u8f render_interval; /* Only one in this many frames is rendered. */
+	cc_u8f frame_counter;
+} fast_forward;
+
+/* How many frames must pass without any sign of run-ahead or netplay before they are assumed to have stopped. */
+#define REPLAY_QUIET_FRAMES 60
+
+/* Run-ahead and netplay run frames that are later thrown away and run again. They give themselves away by hiding frames
+   and by asking for fast save states, so anything that must only see each frame once waits until that stops. */
+static struct
+{
+	cc_u16f quiet_frames;
+} replay;
+
+/* A history of states, so that the frontend can step back through time without having to keep whole states itself. */
+static struct
+{
+	Rewind *history;
+	size_t budget;
+	unsigned char *state;
+	size_t state_capacity;
+	size_t state_size;
+	retro_time_t snapshot_time;
+	unsigned long snapshot_bytes;
+	cc_u16f total_frames;
+	cc_bool stepped; /* Set when the frontend steps back, as the state that the next frame runs from is then already in the history. */
+} rewind_buffer;
+
+/* A digest of the emulator's state can be logged at the end of each frame, for checking that two instances are in sync. */
+static struct
+{
+	cc_bool logging_enabled;
+	unsigned long frame_counter; /* Saved in states, so that frames which are run again after a state is loaded keep their numbers. */
+} state_hash;
 
 static cc_u16l *rom;
 static size_t rom_length;
+static cc_bool rom_is_frontend_owned; /* When set, 'rom' is the frontend's persistent copy of the game, and must not be modified or freed. */
+static size_t rom_mapped_size; /* When non-zero, 'rom' is a private mapping of the ROM file, and must be unmapped rather than freed. */
 
 static CDReader_State cd_reader;
+
+/* While sectors are being read ahead, 'cd_reader' is only told about seeks, so its position must be brought up to date before its state is saved. */
+static struct
+{
+	CDReadAhead *read_ahead;
+	cc_bool enabled;
+	cc_bool reader_stale;
+	char *path;
+} cd_read_ahead;
+
+/* A decoded copy of a compressed disc's data track, kept on disk. When one is available, sectors are read from it instead of the disc. */
+static struct
+{
+	DiscCache *cache;
+	DiscCacheBuilder *builder;
+	unsigned long size_limit; /* In mebibytes. Zero when the cache is disabled. */
+	cc_bool positioned;
+	cc_u32f position;
+} disc_cache;
+
+/* Whether discs are read into memory in full when they are loaded, and whether the current one was. */
+static struct
+{
+	cc_bool enabled;
+	cc_bool active;
+} disc_preload;
+
+/* The size of the blocks that disc image files are read in, in bytes. Only applied when a disc is loaded, as worker threads may be reading otherwise. */
+static size_t disc_block_size;
+
+/* While CD audio is being decoded ahead, 'cd_reader' is only told which track to play, and the position within it is kept by the decoder. */
+static struct
+{
+	CDDADecodeAhead *decode_ahead;
+	cc_bool enabled;
+} cdda_decode_ahead;
+
+/* A burst of sector reads is treated as the game loading, which ends once no sectors have been read for a while. Its duration is logged, to measure how long games spend loading. */
+static struct
+{
+	cc_bool loading;
+	cc_u32f sectors_this_frame;
+	cc_u32f total_sectors;
+	cc_u32f total_frames;
+	cc_u32f idle_frames;
+	retro_time_t start_time;
+	retro_time_t end_time;
+	retro_time_t previous_frame_time;
+} cd_loading;
+
+/* While a CD game is loading behind a mostly-still screen, several frames are run for each one that is shown. */
+static struct
+{
+	cc_u8f maximum_factor; /* One when disabled. */
+	cc_bool active;
+	cc_u8f still_frames;
+	cc_u16f changed_scanlines;
+	cc_u32f extra_frames;
+	cc_u32l scanline_hashes[FRAMEBUFFER_HEIGHT];
+} cd_turbo;
+
 static CheatManager cheat_manager;
 
 static cc_bool pal_mode_enabled;
 
-static struct retro_vfs_file_handle *buram_file_handle;
+/* The state of each port's joypad, fetched from the frontend as a bitmask the first time that it is needed after each poll. */
+static struct
+{
+	cc_bool bitmasks_supported;
+	cc_bool fetched[8];
+	cc_u16l buttons[8];
+} input_cache;
+
+typedef enum InputPollingMode
+{
+	INPUT_POLLING_MODE_EARLY,     /* Before the frame is emulated. */
+	INPUT_POLLING_MODE_LATE,      /* When the game first reads a control pad during the frame. */
+	INPUT_POLLING_MODE_CONTINUOUS /* Whenever the game reads a control pad, but no more often than the minimum interval. */
+} InputPollingMode;
+
+static struct
+{
+	InputPollingMode mode;
+	retro_time_t minimum_interval;
+	retro_time_t last_poll_time;
+	cc_bool polled_this_frame;
+} input_polling;
+
+/* The save file that is currently open. Reads are served from a copy of the whole file,
+   and writes are accumulated and then written in one go when the file is closed. */
+static struct
+{
+	struct retro_vfs_file_handle *file; /* Only used when writing. */
+	unsigned char *buffer;
+	bool buffer_is_mapped; /* Only ever set when reading. */
+	size_t buffer_length;
+	size_t buffer_capacity;
+	size_t position;
+	size_t total_bytes;
+	retro_time_t open_time;
+	const char *index_filename;
+	cc_bool write_failed;
+} save_file;
+
+typedef enum BuRAMFileStatus
+{
+	BURAM_FILE_STATUS_UNKNOWN,
+	BURAM_FILE_STATUS_MISSING,
+	BURAM_FILE_STATUS_PRESENT
+} BuRAMFileStatus;
+
+typedef struct BuRAMFile
+{
+	char *filename;
+	char *path;
+	BuRAMFileStatus status;
+	size_t size; /* Only valid when the status is 'BURAM_FILE_STATUS_PRESENT'. */
+} BuRAMFile;
+
+/* What is known about the files in the save directory of the current game. */
+static struct
+{
+	char *directory;
+	BuRAMFile *files;
+	size_t total_files;
+} buram_index;
 
 LibretroCallbacks libretro_callbacks;
 
+/**********/
+/* Replay */
+/**********/
+
+static void Replay_Update(const int audio_video_enable)
+{
+	if ((audio_video_enable & 1) == 0 || (audio_video_enable & 4) != 0)
+		replay.quiet_frames = 0;
+	else if (replay.quiet_frames != REPLAY_QUIET_FRAMES)
+		++replay.quiet_frames;
+}
+
+static cc_bool Replay_IsActive(void)
+{
+	return replay.quiet_frames != REPLAY_QUIET_FRAMES;
+}
+
 /************/
 /* Geometry */
 /************/
@@ -107,6 +365,9 @@ static void Geometry_Update(void)
 
 			libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_GEOMETRY, (void*)&geometry);
 		}
+
+		/* The previous frame cannot be reused, as it has the wrong dimensions. */
+		indexed_frame.frame_changed = cc_true;
 	}
 }
 
@@ -135,34 +396,66 @@ static void Geometry_SetTallInterlaceMode2(const cc_bool tall_interlace_mode_2)
 /* File IO */
 /***********/
 
-static bool CreateROMBuffer(const unsigned char* const input_buffer, const size_t input_buffer_length, cc_u16l** const output_buffer, size_t* const output_buffer_length)
+/* Converts the big-endian byte pairs of a ROM to native 'cc_u16l' words.
+   'output' may be the same buffer as 'input', but only if 'cc_u16l' is exactly two bytes. */
+static void ConvertROMWords(cc_u16l* const output, const unsigned char* const input, const size_t total_words)
 {
-	const size_t buffer_length = input_buffer_length / 2;
-
-	cc_u16l* const buffer = (cc_u16l*)malloc(buffer_length * sizeof(cc_u16l));
+	size_t i = 0;
 
-	if (buffer == NULL)
+	if (sizeof(cc_u16l) == 2)
 	{
-		return false;
-	}
-	else
-	{
-		size_t i;
+	#if RETRO_IS_BIG_ENDIAN
+		/* The bytes are already in the right order. */
+		if ((const void*)output != (const void*)input)
+			memmove(output, input, total_words * 2);
 
-		for (i = 0; i < buffer_length; ++i)
-			buffer[i] = input_buffer[i * 2 + 0] << 8 | input_buffer[i * 2 + 1] << 0;
+		i = total_words;
+	#else
+		/* Swap four words at a time using plain integer operations, which compilers readily vectorise. */
+		const uint64_t low_bytes = (uint64_t)0x00FF00FF << 32 | 0x00FF00FF;
 
-		*output_buffer = buffer;
-		*output_buffer_length = buffer_length;
+		for (; i + 4 <= total_words; i += 4)
+		{
+			uint64_t words;
 
-		return true;
+			memcpy(&words, &input[i * 2], sizeof(words));
+			words = (words & low_bytes) << 8 | (words >> 8 & low_bytes);
+			memcpy(&output[i], &words, sizeof(words));
+		}
+	#endif
 	}
+
+	for (; i < total_words; ++i)
+		output[i] = input[i * 2 + 0] << 8 | input[i * 2 + 1] << 0;
 }
 
 /************************/
 /* ClownMDEmu Callbacks */
 /************************/
 
+static void UpdateColour_16Bit(const cc_u16f index, const uint16_t colour)
+{
+	/* Games often re-upload their palette every frame, so ignore writes that do not change anything. */
+	if (colours.u16[index] != colour)
+	{
+		colours.u16[index] = colour;
+
+		indexed_frame.palette_changed = cc_true;
+		indexed_frame.frame_changed = cc_true;
+	}
+}
+
+static void UpdateColour_32Bit(const cc_u16f index, const uint32_t colour)
+{
+	if (colours.u32[index] != colour)
+	{
+		colours.u32[index] = colour;
+
+		indexed_frame.palette_changed = cc_true;
+		indexed_frame.frame_changed = cc_true;
+	}
+}
+
 static void ColourUpdatedCallback_0RGB1555(void* const user_data, const cc_u16f index, const cc_u16f colour)
 {
 	/* Convert from 0BGR4444 to 0RGB1555. */
@@ -172,9 +465,9 @@ static void ColourUpdatedCallback_0RGB1555(void* const user_data, const cc_u16f
 
 	(void)user_data;
 
-	colours.u16[index] = (((red   << 1) | (red   >> 3)) << (5 * 2))
-	                   | (((green << 1) | (green >> 3)) << (5 * 1))
-	                   | (((blue  << 1) | (blue  >> 3)) << (5 * 0));
+	UpdateColour_16Bit(index, (((red   << 1) | (red   >> 3)) << (5 * 2))
+	                        | (((green << 1) | (green >> 3)) << (5 * 1))
+	                        | (((blue  << 1) | (blue  >> 3)) << (5 * 0)));
 }
 
 static void ColourUpdatedCallback_RGB565(void* const user_data, const cc_u16f index, const cc_u16f colour)
@@ -186,9 +479,9 @@ static void ColourUpdatedCallback_RGB565(void* const user_data, const cc_u16f in
 
 	(void)user_data;
 
-	colours.u16[index] = (((red   << 1) | (red   >> 3)) << 11)
-	                   | (((green << 2) | (green >> 2)) << 5)
-	                   | (((blue  << 1) | (blue  >> 3)) << 0);
+	UpdateColour_16Bit(index, (((red   << 1) | (red   >> 3)) << 11)
+	                        | (((green << 2) | (green >> 2)) << 5)
+	                        | (((blue  << 1) | (blue  >> 3)) << 0));
 }
 
 static void ColourUpdatedCallback_XRGB8888(void* const user_data, const cc_u16f index, const cc_u16f colour)
@@ -200,43 +493,145 @@ static void ColourUpdatedCallback_XRGB8888(void* const user_data, const cc_u16f
 
 	(void)user_data;
 
-	colours.u32[index] = (((red   << 4) | (red   >> 0)) << (8 * 2))
-	                   | (((green << 4) | (green >> 0)) << (8 * 1))
-	                   | (((blue  << 4) | (blue  >> 0)) << (8 * 0));
+	UpdateColour_32Bit(index, (((red   << 4) | (red   >> 0)) << (8 * 2))
+	                        | (((green << 4) | (green >> 0)) << (8 * 1))
+	                        | (((blue  << 4) | (blue  >> 0)) << (8 * 0)));
 }
 
-static void ScanlineRenderedCallback_16Bit(void* const user_data, const cc_u8l* const source_pixels, void* const destination_pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+static void ConvertScanline_16Bit(const PixelConversion_Palette* const palette, const cc_u8l* const source_pixels, void* const destination_pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
 {
-	const cc_u8l *source_pixel_pointer = source_pixels + left_boundary;
-	uint16_t *destination_pixel_pointer = (uint16_t*)destination_pixels + left_boundary;
+	pixel_conversion_kernel->convert_16bit((uint16_t*)destination_pixels + left_boundary, source_pixels + left_boundary, palette, right_boundary - left_boundary);
+}
 
-	unsigned int i;
+static void ConvertScanline_32Bit(const PixelConversion_Palette* const palette, const cc_u8l* const source_pixels, void* const destination_pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+{
+	pixel_conversion_kernel->convert_32bit((uint32_t*)destination_pixels + left_boundary, source_pixels + left_boundary, palette, right_boundary - left_boundary);
+}
 
-	(void)user_data;
+static void IndexedFrame_StoreScanline(const cc_u16f scanline, const cc_u8l* const pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+{
+	cc_u8l* const destination = &indexed_frame.pixels[scanline][left_boundary];
+	const size_t length = right_boundary - left_boundary;
 
-	for (i = left_boundary; i < right_boundary; ++i)
-		*destination_pixel_pointer++ = colours.u16[*source_pixel_pointer++];
+	/* Compare against the previous frame's scanline, to detect frames that can be sent as duplicates. */
+	if (indexed_frame.scanlines[scanline].left_boundary != left_boundary
+	 || indexed_frame.scanlines[scanline].right_boundary != right_boundary
+	 || memcmp(destination, &pixels[left_boundary], length) != 0)
+	{
+		memcpy(destination, &pixels[left_boundary], length);
+
+		indexed_frame.scanlines[scanline].left_boundary = left_boundary;
+		indexed_frame.scanlines[scanline].right_boundary = right_boundary;
+
+		indexed_frame.frame_changed = cc_true;
+	}
+}
+
+static void IndexedFrame_DeferScanline(const cc_u16f scanline, const cc_u8l* const pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+{
+	/* Only snapshot the palette when it has changed since the previous scanline. */
+	if (indexed_frame.palette_changed)
+	{
+		indexed_frame.palette_changed = cc_false;
+		indexed_frame.palettes[indexed_frame.total_palettes++] = colours;
+	}
+
+	IndexedFrame_StoreScanline(scanline, pixels, left_boundary, right_boundary);
+
+	indexed_frame.scanlines[scanline].palette_index = indexed_frame.total_palettes - 1;
+	indexed_frame.scanlines[scanline].pending = cc_true;
+}
+
+static void IndexedFrame_ConvertScanline(const cc_u16f scanline)
+{
+	convert_scanline(&indexed_frame.palettes[indexed_frame.scanlines[scanline].palette_index], indexed_frame.pixels[scanline], (unsigned char*)current_framebuffer + (current_framebuffer_pitch * scanline), indexed_frame.scanlines[scanline].left_boundary, indexed_frame.scanlines[scanline].right_boundary);
 }
 
-static void ScanlineRenderedCallback_32Bit(void* const user_data, const cc_u8l* const source_pixels, void* const destination_pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+static void IndexedFrame_Convert(void)
 {
-	const cc_u8l *source_pixel_pointer = source_pixels + left_boundary;
-	uint32_t *destination_pixel_pointer = (uint32_t*)destination_pixels + left_boundary;
+	cc_u16f scanline;
 
-	unsigned int i;
+	for (scanline = 0; scanline < geometry.current_screen_height; ++scanline)
+	{
+		if (indexed_frame.scanlines[scanline].pending)
+		{
+			indexed_frame.scanlines[scanline].pending = cc_false;
+
+			IndexedFrame_ConvertScanline(scanline);
+		}
+	}
+}
+
+static void ConversionThreadCallback(void* const user_data, const cc_u16f scanline)
+{
+	const retro_time_t start_time = libretro_callbacks.get_time_usec();
 
 	(void)user_data;
 
+	/* Everything that this reads was written by the emulation thread before the scanline was submitted,
+	   and none of it is modified again until the frame is finished. */
+	IndexedFrame_ConvertScanline(scanline);
+
+	conversion_thread.busy_time += libretro_callbacks.get_time_usec() - start_time;
+}
+
+static void ConversionThread_Finish(void)
+{
+	const retro_time_t start_time = libretro_callbacks.get_time_usec();
+
+	WorkerThread_Finish(conversion_thread.worker);
+
+	/* The time saved is however long the conversion took, minus however long the emulation thread had to wait for it. */
+	conversion_thread.time_saved += conversion_thread.busy_time - (libretro_callbacks.get_time_usec() - start_time);
+	conversion_thread.busy_time = 0;
+
+	if (++conversion_thread.total_frames == 60 * 10)
+	{
+		libretro_callbacks.log(RETRO_LOG_DEBUG, "Threaded colour conversion saved %ldus per frame on average.\n", (long)(conversion_thread.time_saved / (retro_time_t)conversion_thread.total_frames));
+
+		conversion_thread.time_saved = 0;
+		conversion_thread.total_frames = 0;
+	}
+}
+
+static void CDTurbo_CheckScanline(const cc_u16f scanline, const cc_u8l* const pixels, const cc_u16f left_boundary, const cc_u16f right_boundary)
+{
+	/* Only whether the scanline changed matters, so a simple FNV-1a hash is enough. */
+	cc_u32f hash = 0x811C9DC5 ^ left_boundary ^ right_boundary << 16;
+	cc_u16f i;
+
 	for (i = left_boundary; i < right_boundary; ++i)
-		*destination_pixel_pointer++ = colours.u32[*source_pixel_pointer++];
+		hash = ((hash ^ pixels[i]) * 0x01000193) & 0xFFFFFFFF;
+
+	if (cd_turbo.scanline_hashes[scanline] != hash)
+	{
+		cd_turbo.scanline_hashes[scanline] = hash;
+		++cd_turbo.changed_scanlines;
+	}
 }
 
 static void ScanlineRenderedCallback(void* const user_data, const cc_u16f scanline, const cc_u8l* const pixels, const cc_u16f left_boundary, const cc_u16f right_boundary, const cc_u16f screen_width, const cc_u16f screen_height)
 {
+	(void)user_data;
+
+	/* This is needed even for frames that are not shown, as most frames are not shown while the turbo is active. */
+	if (cd_turbo.maximum_factor > 1 && scanline < FRAMEBUFFER_HEIGHT && CDReader_IsOpen(&cd_reader))
+		CDTurbo_CheckScanline(scanline, pixels, left_boundary, right_boundary);
+
+	/* Keep track of the screen size, but otherwise ignore the frame. */
+	if (frame_output.skip_video)
+	{
+		if (scanline == 0)
+			Geometry_SetScreenSize(screen_width, screen_height);
+
+		return;
+	}
+
 	/* At the start of the frame, update the screen width and height
 	   and obtain a new framebuffer from the frontend. */
 	if (scanline == 0)
 	{
+		void (* const previous_convert_scanline)(const PixelConversion_Palette *palette, const cc_u8l *source_pixels, void *destination_pixels, cc_u16f left_boundary, cc_u16f right_boundary) = convert_scanline;
 		struct retro_framebuffer frontend_framebuffer;
 
 		frontend_framebuffer.width = screen_width;
@@ -260,17 +655,17 @@ static void ScanlineRenderedCallback(void* const user_data, const cc_u16f scanli
 					/* Fallthrough */
 				case RETRO_PIXEL_FORMAT_0RGB1555:
 					clownmdemu_callbacks.colour_updated = ColourUpdatedCallback_0RGB1555;
-					scanline_rendered_callback = ScanlineRenderedCallback_16Bit;
+					convert_scanline = ConvertScanline_16Bit;
 					break;
 
 				case RETRO_PIXEL_FORMAT_XRGB8888:
 					clownmdemu_callbacks.colour_updated = ColourUpdatedCallback_XRGB8888;
-					scanline_rendered_callback = ScanlineRenderedCallback_32Bit;
+					convert_scanline = ConvertScanline_32Bit;
 					break;
 
 				case RETRO_PIXEL_FORMAT_RGB565:
 					clownmdemu_callbacks.colour_updated = ColourUpdatedCallback_RGB565;
-					scanline_rendered_callback = ScanlineRenderedCallback_16Bit;
+					convert_scanline = ConvertScanline_16Bit;
 					break;
 			}
 		}
@@ -278,7 +673,7 @@ static void ScanlineRenderedCallback(void* const user_data, const cc_u16f scanli
 		{
 			/* Fall back on the internal framebuffer if the frontend one could not be
 			   obtained or was in an incompatible format. */
-			if (fallback_scanline_rendered_callback == ScanlineRenderedCallback_16Bit)
+			if (fallback_convert_scanline == ConvertScanline_16Bit)
 			{
 				current_framebuffer = fallback_framebuffer.u16;
 				current_framebuffer_pitch = sizeof(fallback_framebuffer.u16[0]);
@@ -290,15 +685,48 @@ static void ScanlineRenderedCallback(void* const user_data, const cc_u16f scanli
 			}
 
 			clownmdemu_callbacks.colour_updated = fallback_colour_updated_callback;
-			scanline_rendered_callback = fallback_scanline_rendered_callback;
+			convert_scanline = fallback_convert_scanline;
 		}
 
 		Geometry_SetScreenSize(screen_width, screen_height);
+
+		/* A change of pixel format invalidates the previous frame. */
+		if (convert_scanline != previous_convert_scanline)
+			indexed_frame.frame_changed = cc_true;
+
+		indexed_frame.total_palettes = 0;
+		indexed_frame.palette_changed = cc_true;
 	}
 
 	/* Prevent mid-frame resolution changes from causing out-of-bound framebuffer accesses. */
 	if (scanline < geometry.current_screen_height)
-		scanline_rendered_callback(user_data, pixels, (unsigned char*)current_framebuffer + (current_framebuffer_pitch * scanline), left_boundary, right_boundary);
+	{
+		if (colour_conversion_mode == COLOUR_CONVERSION_MODE_FRAME)
+		{
+			IndexedFrame_DeferScanline(scanline, pixels, left_boundary, right_boundary);
+		}
+		else if (colour_conversion_mode == COLOUR_CONVERSION_MODE_THREADED)
+		{
+			IndexedFrame_DeferScanline(scanline, pixels, left_boundary, right_boundary);
+			WorkerThread_Submit(conversion_thread.worker, scanline);
+		}
+		else
+		{
+			convert_scanline(&colours, pixels, (unsigned char*)current_framebuffer + (current_framebuffer_pitch * scanline), left_boundary, right_boundary);
+		}
+	}
+}
+
+static void PollInput(void)
+{
+	cc_u8f i;
+
+	libretro_callbacks.input_poll();
+
+	for (i = 0; i < CC_COUNT_OF(input_cache.fetched); ++i)
+		input_cache.fetched[i] = cc_false;
+
+	input_polling.polled_this_frame = cc_true;
 }
 
 static cc_bool InputRequestedCallback(void* const user_data, const cc_u8f player_id, const ClownMDEmu_Button button_id)
@@ -307,6 +735,32 @@ static cc_bool InputRequestedCallback(void* const user_data, const cc_u8f player
 
 	(void)user_data;
 
+	/* Polling as late as possible reduces input latency. */
+	switch (input_polling.mode)
+	{
+		case INPUT_POLLING_MODE_EARLY:
+			break;
+
+		case INPUT_POLLING_MODE_LATE:
+			if (!input_polling.polled_this_frame)
+				PollInput();
+
+			break;
+
+		case INPUT_POLLING_MODE_CONTINUOUS:
+		{
+			const retro_time_t current_time = libretro_callbacks.get_time_usec();
+
+			if (!input_polling.polled_this_frame || current_time - input_polling.last_poll_time >= input_polling.minimum_interval)
+			{
+				PollInput();
+				input_polling.last_poll_time = current_time;
+			}
+
+			break;
+		}
+	}
+
 	switch (button_id)
 	{
 		default:
@@ -360,54 +814,216 @@ static cc_bool InputRequestedCallback(void* const user_data, const cc_u8f player
 			break;
 	}
 
-	return libretro_callbacks.input_state(player_id, RETRO_DEVICE_JOYPAD, 0, libretro_button_id);
+	/* Fall back on querying buttons individually if the frontend does not support bitmasks. */
+	if (!input_cache.bitmasks_supported || player_id >= CC_COUNT_OF(input_cache.buttons))
+		return libretro_callbacks.input_state(player_id, RETRO_DEVICE_JOYPAD, 0, libretro_button_id);
+
+	if (!input_cache.fetched[player_id])
+	{
+		input_cache.fetched[player_id] = cc_true;
+		input_cache.buttons[player_id] = (cc_u16l)libretro_callbacks.input_state(player_id, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK);
+	}
+
+	return (input_cache.buttons[player_id] >> libretro_button_id & 1) != 0;
+}
+
+static void MixerCompleteCallback(void* const user_data, const cc_s16l* const audio_samples, const size_t total_frames)
+{
+	(void)user_data;
+
+	if (!frame_output.skip_audio)
+		libretro_callbacks.audio_batch(audio_samples, total_frames);
+}
+
+static cc_s16l* AllocateDiscardedSamples(const size_t total_frames)
+{
+	/* Enough for stereo. */
+	const size_t total_samples = total_frames * 2;
+
+	if (frame_output.mixer_in_use)
+		return NULL;
+
+	if (total_samples > frame_output.discarded_samples_capacity)
+	{
+		cc_s16l* const new_buffer = (cc_s16l*)realloc(frame_output.discarded_samples, total_samples * sizeof(cc_s16l));
+
+		if (new_buffer == NULL)
+		{
+			/* Fall back on the mixer, and discard its output at the end of the frame instead. */
+			Mixer_Begin(&mixer);
+			frame_output.mixer_in_use = cc_true;
+			return NULL;
+		}
+
+		frame_output.discarded_samples = new_buffer;
+		frame_output.discarded_samples_capacity = total_samples;
+	}
+
+	return frame_output.discarded_samples;
 }
 
+/* When audio is being skipped, it still has to be generated to keep the emulated state the same,
+   but it is written to a scratch buffer instead of being mixed and resampled. */
 static void FMAudioToBeGeneratedCallback(void* const user_data, ClownMDEmu* const clownmdemu, const size_t total_frames, void (* const generate_fm_audio)(ClownMDEmu *clownmdemu, cc_s16l *sample_buffer, size_t total_frames))
 {
+	cc_s16l* const discarded_samples = AllocateDiscardedSamples(total_frames);
+
 	(void)user_data;
 
-	generate_fm_audio(clownmdemu, Mixer_AllocateFMSamples(&mixer, total_frames), total_frames);
+	generate_fm_audio(clownmdemu, discarded_samples != NULL ? discarded_samples : Mixer_AllocateFMSamples(&mixer, total_frames), total_frames);
 }
 
 static void PSGAudioToBeGeneratedCallback(void* const user_data, ClownMDEmu* const clownmdemu, const size_t total_samples, void (* const generate_psg_audio)(ClownMDEmu *clownmdemu, cc_s16l *sample_buffer, size_t total_samples))
 {
+	cc_s16l* const discarded_samples = AllocateDiscardedSamples(total_samples);
+
 	(void)user_data;
 
-	generate_psg_audio(clownmdemu, Mixer_AllocatePSGSamples(&mixer, total_samples), total_samples);
+	generate_psg_audio(clownmdemu, discarded_samples != NULL ? discarded_samples : Mixer_AllocatePSGSamples(&mixer, total_samples), total_samples);
 }
 
 static void PCMAudioToBeGeneratedCallback(void* const user_data, ClownMDEmu* const clownmdemu, const size_t total_frames, void (* const generate_pcm_audio)(ClownMDEmu *clownmdemu, cc_s16l *sample_buffer, size_t total_frames))
 {
+	cc_s16l* const discarded_samples = AllocateDiscardedSamples(total_frames);
+
 	(void)user_data;
 
-	generate_pcm_audio(clownmdemu, Mixer_AllocatePCMSamples(&mixer, total_frames), total_frames);
+	generate_pcm_audio(clownmdemu, discarded_samples != NULL ? discarded_samples : Mixer_AllocatePCMSamples(&mixer, total_frames), total_frames);
 }
 
 static void CDDAAudioToBeGeneratedCallback(void* const user_data, ClownMDEmu* const clownmdemu, const size_t total_frames, void (* const generate_cdda_audio)(ClownMDEmu *clownmdemu, cc_s16l *sample_buffer, size_t total_frames))
 {
+	cc_s16l* const discarded_samples = AllocateDiscardedSamples(total_frames);
+
 	(void)user_data;
 
-	generate_cdda_audio(clownmdemu, Mixer_AllocateCDDASamples(&mixer, total_frames), total_frames);
+	generate_cdda_audio(clownmdemu, discarded_samples != NULL ? discarded_samples : Mixer_AllocateCDDASamples(&mixer, total_frames), total_frames);
+}
+
+static void SynchroniseCDReaderSector(void)
+{
+	cc_u32f sector_index;
+
+	if (cd_read_ahead.reader_stale)
+	{
+		if (disc_cache.cache != NULL)
+		{
+			if (disc_cache.positioned)
+				CDReader_SeekToSector(&cd_reader, disc_cache.position);
+		}
+		else if (CDReadAhead_GetPosition(cd_read_ahead.read_ahead, &sector_index))
+		{
+			CDReader_SeekToSector(&cd_reader, sector_index);
+		}
+	}
+
+	cd_read_ahead.reader_stale = cc_false;
+}
+
+static void SkipCDReaderAudio(cc_u32f total_frames)
+{
+	/* There is no way to seek within a track, so the frames have to be decoded. This only happens when a position from the decoder is handed back to 'cd_reader'. */
+	while (total_frames != 0)
+	{
+		cc_s16l discarded_frames[0x200 * 2];
+		const cc_u32f frames = CDReader_ReadAudio(&cd_reader, discarded_frames, CC_MIN(total_frames, CC_COUNT_OF(discarded_frames) / 2));
+
+		if (frames == 0)
+			break;
+
+		total_frames -= frames;
+	}
+}
+
+static void StopCDDADecodeAhead(void)
+{
+	/* 'cd_reader' is about to move away from the audio, so the decoder no longer knows its position. */
+	if (cdda_decode_ahead.decode_ahead != NULL)
+		CDDADecodeAhead_Stop(cdda_decode_ahead.decode_ahead);
+}
+
+static void UpdateCDReadAhead(void)
+{
+	/* Reading from the disc cache or from memory is cheap enough that reading ahead is pointless. */
+	if (cd_read_ahead.enabled && cd_read_ahead.read_ahead == NULL && cd_read_ahead.path != NULL && disc_cache.cache == NULL && !disc_preload.active)
+	{
+		/* Reading ahead begins at the next seek. */
+		cd_read_ahead.read_ahead = CDReadAhead_Create(cd_read_ahead.path);
+	}
+	else if (!cd_read_ahead.enabled && cd_read_ahead.read_ahead != NULL)
+	{
+		SynchroniseCDReaderSector();
+		CDReadAhead_Destroy(cd_read_ahead.read_ahead);
+		cd_read_ahead.read_ahead = NULL;
+	}
+
+	/* Decoding audio is costly even when reading the disc is not, so the audio is decoded ahead regardless of where the disc is read from. */
+	if (cdda_decode_ahead.enabled && cdda_decode_ahead.decode_ahead == NULL && cd_read_ahead.path != NULL)
+	{
+		/* Decoding ahead begins when the next track is played. */
+		cdda_decode_ahead.decode_ahead = CDDADecodeAhead_Create(cd_read_ahead.path, disc_preload.active ? &clowncd_preloaded_callbacks : &clowncd_callbacks);
+	}
+	else if (!cdda_decode_ahead.enabled && cdda_decode_ahead.decode_ahead != NULL)
+	{
+		CDReader_StateBackup cd_reader_backup;
+		cc_u32f audio_frame_offset;
+
+		/* Hand the audio position back to 'cd_reader'. */
+		if (CDDADecodeAhead_GetPosition(cdda_decode_ahead.decode_ahead, &cd_reader_backup, &audio_frame_offset))
+		{
+			CDReader_LoadState(&cd_reader, &cd_reader_backup);
+			SkipCDReaderAudio(audio_frame_offset);
+		}
+
+		CDDADecodeAhead_Destroy(cdda_decode_ahead.decode_ahead);
+		cdda_decode_ahead.decode_ahead = NULL;
+	}
 }
 
 static void CDSeekCallback(void* const user_data, const cc_u32f sector_index)
 {
 	(void)user_data;
 
+	StopCDDADecodeAhead();
+
 	CDReader_SeekToSector(&cd_reader, sector_index);
+	cd_read_ahead.reader_stale = cc_false;
+
+	disc_cache.positioned = cc_true;
+	disc_cache.position = sector_index;
+
+	if (cd_read_ahead.read_ahead != NULL)
+		CDReadAhead_Seek(cd_read_ahead.read_ahead, sector_index);
 }
 
 static void CDSectorReadCallback(void* const user_data, cc_u16l* const buffer)
 {
 	(void)user_data;
 
-	CDReader_ReadSector(&cd_reader, buffer);
+	++cd_loading.sectors_this_frame;
+
+	if (disc_cache.cache != NULL && disc_cache.positioned && DiscCache_ReadSector(disc_cache.cache, disc_cache.position, buffer))
+	{
+		++disc_cache.position;
+		cd_read_ahead.reader_stale = cc_true;
+	}
+	else if (cd_read_ahead.read_ahead != NULL && CDReadAhead_ReadSector(cd_read_ahead.read_ahead, buffer))
+	{
+		cd_read_ahead.reader_stale = cc_true;
+	}
+	else
+	{
+		/* Anything past the end of the cached data track, such as audio, still comes from the disc. */
+		StopCDDADecodeAhead();
+		SynchroniseCDReaderSector();
+		CDReader_ReadSector(&cd_reader, buffer);
+	}
 }
 
 static cc_bool CDSeekTrackCallback(void* const user_data, const cc_u16f track_index, const ClownMDEmu_CDDAMode mode)
 {
 	CDReader_PlaybackSetting playback_setting;
+	cc_bool success;
 
 	(void)user_data;
 
@@ -430,66 +1046,337 @@ static cc_bool CDSeekTrackCallback(void* const user_data, const cc_u16f track_in
 			break;
 	}
 
-	return CDReader_PlayAudio(&cd_reader, track_index, playback_setting);
-}
+	/* Playing a track moves the reader to it, so the sector that data was last read from must not be restored over it later. */
+	cd_read_ahead.reader_stale = cc_false;
+	disc_cache.positioned = cc_false;
+
+	if (cd_read_ahead.read_ahead != NULL)
+		CDReadAhead_Invalidate(cd_read_ahead.read_ahead);
+
+	success = CDReader_PlayAudio(&cd_reader, track_index, playback_setting);
+
+	/* Whether or not the track could be played, the decoder's previous position no longer matters. */
+	if (cdda_decode_ahead.decode_ahead != NULL)
+	{
+		CDReader_StateBackup cd_reader_backup;
+
+		/* Zeroed, as the decoder finds the chunk that a position belongs to by comparing whole states. */
+		memset(&cd_reader_backup, 0, sizeof(cd_reader_backup));
+		CDReader_SaveState(&cd_reader, &cd_reader_backup);
+		CDDADecodeAhead_Start(cdda_decode_ahead.decode_ahead, &cd_reader_backup, 0);
+	}
+
+	return success;
+}
+
+static size_t CDAudioReadCallback(void* const user_data, cc_s16l* const sample_buffer, const size_t total_frames)
+{
+	cc_u32f frames_read;
 
-static size_t CDAudioReadCallback(void* const user_data, cc_s16l* const sample_buffer, const size_t total_frames)
-{
 	(void)user_data;
 
+	if (cdda_decode_ahead.decode_ahead != NULL && CDDADecodeAhead_Read(cdda_decode_ahead.decode_ahead, sample_buffer, total_frames, &frames_read))
+		return frames_read;
+
 	return CDReader_ReadAudio(&cd_reader, sample_buffer, total_frames);
 }
 
+/* How many frames without any sector reads end a loading phase. Games pause briefly between files, so this cannot be too short. */
+#define CD_LOADING_IDLE_FRAMES 30
+/* How many consecutive frames of loading behind a still screen it takes for the turbo to kick in, and how many scanlines may change in a still screen. */
+#define CD_TURBO_STILL_FRAMES 10
+#define CD_TURBO_MAXIMUM_CHANGED_SCANLINES 16
+
+static void CDLoading_EndFrame(void)
+{
+	const retro_time_t current_time = libretro_callbacks.get_time_usec();
+
+	if (cd_loading.sectors_this_frame != 0)
+	{
+		/* The phase began at the start of this frame, which is the end of the previous one. */
+		if (!cd_loading.loading)
+		{
+			cd_loading.loading = cc_true;
+			cd_loading.total_sectors = 0;
+			cd_loading.total_frames = 0;
+			cd_loading.start_time = cd_loading.previous_frame_time;
+		}
+
+		cd_loading.total_sectors += cd_loading.sectors_this_frame;
+		cd_loading.idle_frames = 0;
+		cd_loading.end_time = current_time;
+	}
+	else if (cd_loading.loading && ++cd_loading.idle_frames == CD_LOADING_IDLE_FRAMES)
+	{
+		/* The idle frames at the end are not part of the loading phase. */
+		cd_loading.loading = cc_false;
+		cd_loading.total_frames -= CD_LOADING_IDLE_FRAMES - 1;
+
+		libretro_callbacks.log(RETRO_LOG_INFO, "CD loading: %lu sectors over %lu frames (%lu of them extra turbo frames), taking %ldms.\n", (unsigned long)cd_loading.total_sectors, (unsigned long)cd_loading.total_frames, (unsigned long)cd_turbo.extra_frames, (long)((cd_loading.end_time - cd_loading.start_time) / 1000));
+		cd_turbo.extra_frames = 0;
+	}
+
+	if (cd_loading.loading)
+		++cd_loading.total_frames;
+
+	cd_loading.sectors_this_frame = 0;
+	cd_loading.previous_frame_time = current_time;
+
+	/* A busy disc behind a screen that barely changes suggests a loading screen, rather than a video that is being streamed.
+	   A few scanlines are allowed to change, for spinning icons and the like. */
+	if (cd_loading.loading && cd_turbo.changed_scanlines <= CD_TURBO_MAXIMUM_CHANGED_SCANLINES)
+	{
+		if (cd_turbo.still_frames != CD_TURBO_STILL_FRAMES)
+			++cd_turbo.still_frames;
+	}
+	else
+	{
+		cd_turbo.still_frames = 0;
+	}
+
+	cd_turbo.active = cd_turbo.maximum_factor > 1 && cd_turbo.still_frames == CD_TURBO_STILL_FRAMES;
+	cd_turbo.changed_scanlines = 0;
+}
+
+static void CDTurbo_RunExtraFrames(void)
+{
+	const cc_bool skip_video = frame_output.skip_video;
+	cc_u8f i;
+
+	/* Run-ahead and netplay run frames again from states, so the number of frames that each one covers must not depend on anything that is not part of the state. */
+	if (!cd_turbo.active || Replay_IsActive())
+		return;
+
+	/* Only the last frame is shown and heard, so the others are treated like run-ahead frames. */
+	frame_output.skip_video = cc_true;
+	frame_output.mixer_in_use = cc_false;
+
+	for (i = 1; i < cd_turbo.maximum_factor && cd_turbo.active; ++i)
+	{
+		CheatManager_ApplyRAMPatches(&cheat_manager, &clownmdemu);
+		ClownMDEmu_Iterate(&clownmdemu);
+		CDLoading_EndFrame();
+
+		/* If the scratch buffer could not be allocated, then the mixer was used instead, and its output must be thrown away. */
+		if (frame_output.mixer_in_use)
+		{
+			const cc_bool skip_audio = frame_output.skip_audio;
+
+			frame_output.skip_audio = cc_true;
+			Mixer_End(&mixer, MixerCompleteCallback, NULL);
+			frame_output.skip_audio = skip_audio;
+			frame_output.mixer_in_use = cc_false;
+		}
+
+		++cd_turbo.extra_frames;
+	}
+
+	frame_output.skip_video = skip_video;
+}
+
+/* The scanlines that each frame is compared against are not part of the state, so the turbo starts over whenever a state is loaded. */
+static void CDTurbo_Restart(void)
+{
+	cd_turbo.active = cc_false;
+	cd_turbo.still_frames = 0;
+	cd_turbo.changed_scanlines = 0;
+	memset(cd_turbo.scanline_hashes, 0, sizeof(cd_turbo.scanline_hashes));
+}
+
+static void CDTurbo_Reset(void)
+{
+	CDTurbo_Restart();
+	cd_turbo.extra_frames = 0;
+}
+
+/* Whether the game is loading, and for how long the disc has been idle, follow from the game's reads, and so are saved in states. */
+static cc_u32f CDTurbo_SaveState(void)
+{
+	return (cd_loading.loading ? 1 : 0) | (cc_u32f)CC_MIN(cd_loading.idle_frames, 0xFF) << 8;
+}
+
+static void CDTurbo_LoadState(const cc_u32f state)
+{
+	const cc_bool loading = (state & 1) != 0;
+
+	/* The statistics that are logged only cover the loading phase from this point onwards. */
+	if (loading && !cd_loading.loading)
+	{
+		cd_loading.total_sectors = 0;
+		cd_loading.total_frames = 0;
+		cd_loading.start_time = cd_loading.end_time = cd_loading.previous_frame_time;
+	}
+
+	cd_loading.loading = loading;
+	cd_loading.idle_frames = CC_MIN(state >> 8 & 0xFF, CD_LOADING_IDLE_FRAMES);
+
+	CDTurbo_Restart();
+}
+
 static const char* GetBuRAMDirectory(void)
 {
 	const char *path;
 
-	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, (void*)&path))
+	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, (void*)&path) && path != NULL)
 		return path;
 
-	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, (void*)&path))
+	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, (void*)&path) && path != NULL)
 		return path;
 
 	return ".";
 }
 
-static char* GetBuRAMPath(const char* const filename)
+static char* DuplicateString(const char* const string)
+{
+	const size_t length = strlen(string) + 1;
+	char* const copy = (char*)malloc(length);
+
+	if (copy != NULL)
+		memcpy(copy, string, length);
+
+	return copy;
+}
+
+/* Since the BIOS checks the size of its save files far more often than it changes them, the save directory and
+   what is known about each file in it are cached for as long as a game is loaded. The core's own writes and
+   removals keep the cache up to date. */
+static void BuRAMIndex_Clear(void)
+{
+	size_t i;
+
+	for (i = 0; i < buram_index.total_files; ++i)
+	{
+		free(buram_index.files[i].filename);
+		free(buram_index.files[i].path);
+	}
+
+	free(buram_index.files);
+	free(buram_index.directory);
+
+	buram_index.files = NULL;
+	buram_index.total_files = 0;
+	buram_index.directory = NULL;
+}
+
+static BuRAMFile* BuRAMIndex_Find(const char* const filename)
 {
-	const char* const directory = GetBuRAMDirectory();
-	const size_t directory_length = strlen(directory);
-	const size_t filename_length = strlen(filename);
-	char* const buffer = (char*)malloc(directory_length + 1 + filename_length + 1);
+	size_t i;
+
+	for (i = 0; i < buram_index.total_files; ++i)
+		if (strcmp(buram_index.files[i].filename, filename) == 0)
+			return &buram_index.files[i];
 
-	if (buffer != NULL)
+	if (buram_index.directory == NULL)
 	{
-		memcpy(&buffer[0], directory, directory_length);
-		buffer[directory_length] = '/';
-		memcpy(&buffer[directory_length + 1], filename, filename_length);
-		buffer[directory_length + 1 + filename_length] = '\0';
+		buram_index.directory = DuplicateString(GetBuRAMDirectory());
+
+		if (buram_index.directory == NULL)
+			return NULL;
+	}
+
+	{
+		const size_t directory_length = strlen(buram_index.directory);
+		const size_t filename_length = strlen(filename);
+		BuRAMFile* const files = (BuRAMFile*)realloc(buram_index.files, (buram_index.total_files + 1) * sizeof(BuRAMFile));
+		BuRAMFile *file;
+
+		if (files == NULL)
+			return NULL;
+
+		buram_index.files = files;
+		file = &files[buram_index.total_files];
+
+		file->filename = DuplicateString(filename);
+		file->path = (char*)malloc(directory_length + 1 + filename_length + 1);
+		file->status = BURAM_FILE_STATUS_UNKNOWN;
+		file->size = 0;
+
+		if (file->filename == NULL || file->path == NULL)
+		{
+			free(file->filename);
+			free(file->path);
+			return NULL;
+		}
+
+		memcpy(&file->path[0], buram_index.directory, directory_length);
+		file->path[directory_length] = '/';
+		memcpy(&file->path[directory_length + 1], filename, filename_length);
+		file->path[directory_length + 1 + filename_length] = '\0';
+
+		++buram_index.total_files;
+
+		return file;
 	}
+}
 
-	return buffer;
+static void BuRAMIndex_SetStatus(BuRAMFile* const file, const BuRAMFileStatus status, const size_t size)
+{
+	file->status = status;
+	file->size = size;
 }
 
 static cc_bool SaveFileOpened(void* const user_data, const char* const filename, const bool read_or_write)
 {
 	cc_bool success = cc_false;
 
-	char* const path = GetBuRAMPath(filename);
+	BuRAMFile* const index_file = BuRAMIndex_Find(filename);
 
 	(void)user_data;
 
-	if (path != NULL)
+	save_file.open_time = libretro_callbacks.get_time_usec();
+	save_file.file = NULL;
+	save_file.buffer = NULL;
+	save_file.buffer_is_mapped = false;
+	save_file.buffer_length = 0;
+	save_file.buffer_capacity = 0;
+	save_file.position = 0;
+	save_file.total_bytes = 0;
+	save_file.index_filename = NULL;
+	save_file.write_failed = cc_false;
+
+	if (index_file != NULL)
 	{
-		buram_file_handle = file_io.open(path, read_or_write ? RETRO_VFS_FILE_ACCESS_WRITE : RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
-		success = buram_file_handle != NULL;
+		if (read_or_write)
+		{
+			/* The file is opened now, rather than when it is flushed, so that failure can be reported immediately. */
+			save_file.file = file_io.open(index_file->path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+			success = save_file.file != NULL;
+
+			/* Whatever was there before is gone, and what replaces it is not known until the file is closed. */
+			BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_UNKNOWN, 0);
+		}
+		else
+		{
+			/* Avoid trying to open a file that is already known to not exist. The file is only read, so it can be mapped into memory instead of copied. */
+			if (index_file->status != BURAM_FILE_STATUS_MISSING)
+				success = LoadFileToBuffer(index_file->path, &save_file.buffer, &save_file.buffer_length, &save_file.buffer_is_mapped);
+
+			/* Other failures, such as running out of memory, may be temporary, so they leave the status alone. */
+			if (success)
+				BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_PRESENT, save_file.buffer_length);
+			else if (index_file->status == BURAM_FILE_STATUS_UNKNOWN && FileIsMissing(index_file->path))
+				BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_MISSING, 0);
+		}
 
-		free(path);
+		/* The array may be reallocated while the file is open, so remember the file by name instead. */
+		if (success)
+			save_file.index_filename = index_file->filename;
 	}
 
 	return success;
 }
 
+static void SaveFileFlush(void)
+{
+	if (save_file.buffer_length != 0)
+	{
+		if (file_io.write(save_file.file, save_file.buffer, save_file.buffer_length) != (int64_t)save_file.buffer_length)
+			save_file.write_failed = cc_true;
+
+		save_file.buffer_length = 0;
+	}
+}
+
 static cc_bool SaveFileOpenedForReadingCallback(void* const user_data, const char* const filename)
 {
 	return SaveFileOpened(user_data, filename, false);
@@ -497,14 +1384,14 @@ static cc_bool SaveFileOpenedForReadingCallback(void* const user_data, const cha
 
 static cc_s16f SaveFileReadCallback(void* const user_data)
 {
-	uint8_t byte;
-
 	(void)user_data;
 
-	if (file_io.read(buram_file_handle, &byte, 1) == 0)
+	if (save_file.position == save_file.buffer_length)
 		return -1;
 
-	return byte;
+	++save_file.total_bytes;
+
+	return save_file.buffer[save_file.position++];
 }
 
 static cc_bool SaveFileOpenedForWritingCallback(void* const user_data, const char* const filename)
@@ -514,33 +1401,82 @@ static cc_bool SaveFileOpenedForWritingCallback(void* const user_data, const cha
 
 static void SaveFileWrittenCallback(void* const user_data, const cc_u8f byte)
 {
-	const uint8_t value = byte;
-
 	(void)user_data;
 
-	file_io.write(buram_file_handle, &value, 1);
+	if (save_file.buffer_length == save_file.buffer_capacity)
+	{
+		const size_t new_capacity = save_file.buffer_capacity == 0 ? 0x2000 : save_file.buffer_capacity * 2;
+		unsigned char* const new_buffer = (unsigned char*)realloc(save_file.buffer, new_capacity);
+
+		if (new_buffer != NULL)
+		{
+			save_file.buffer = new_buffer;
+			save_file.buffer_capacity = new_capacity;
+		}
+		else
+		{
+			/* Make room by writing what has been accumulated so far. */
+			SaveFileFlush();
+		}
+	}
+
+	if (save_file.buffer_length != save_file.buffer_capacity)
+	{
+		save_file.buffer[save_file.buffer_length++] = (unsigned char)byte;
+	}
+	else
+	{
+		/* There is no buffer at all, so write the byte directly. */
+		const uint8_t value = byte;
+
+		if (file_io.write(save_file.file, &value, 1) != 1)
+			save_file.write_failed = cc_true;
+	}
+
+	++save_file.total_bytes;
 }
 
 static void SaveFileClosedCallback(void* const user_data)
 {
 	(void)user_data;
 
-	file_io.close(buram_file_handle);
+	if (save_file.file != NULL)
+	{
+		SaveFileFlush();
+		file_io.close(save_file.file);
+		save_file.file = NULL;
+
+		/* If everything was written, then the size of the file is known without having to ask. */
+		if (save_file.index_filename != NULL && !save_file.write_failed)
+		{
+			BuRAMFile* const index_file = BuRAMIndex_Find(save_file.index_filename);
+
+			if (index_file != NULL)
+				BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_PRESENT, save_file.total_bytes);
+		}
+	}
+
+	FreeFileBuffer(save_file.buffer, save_file.buffer_length, save_file.buffer_is_mapped);
+	save_file.buffer = NULL;
+	save_file.buffer_is_mapped = false;
+
+	libretro_callbacks.log(RETRO_LOG_DEBUG, "Save file: %lu bytes transferred in %ldus from open to close.\n", (unsigned long)save_file.total_bytes, (long)(libretro_callbacks.get_time_usec() - save_file.open_time));
 }
 
 static cc_bool SaveFileRemovedCallback(void* const user_data, const char* const filename)
 {
 	cc_bool success = cc_false;
 
-	char* const path = GetBuRAMPath(filename);
+	BuRAMFile* const index_file = BuRAMIndex_Find(filename);
 
 	(void)user_data;
 
-	if (path != NULL)
+	if (index_file != NULL)
 	{
-		success = file_io.remove(path) == 0;
+		success = file_io.remove(index_file->path) == 0;
 
-		free(path);
+		/* If removal failed, then it is unclear whether the file is still there. */
+		BuRAMIndex_SetStatus(index_file, success ? BURAM_FILE_STATUS_MISSING : BURAM_FILE_STATUS_UNKNOWN, 0);
 	}
 
 	return success;
@@ -548,29 +1484,42 @@ static cc_bool SaveFileRemovedCallback(void* const user_data, const char* const
 
 static cc_bool SaveFileSizeObtainedCallback(void* const user_data, const char* const filename, size_t* const size)
 {
-	cc_bool success = cc_false;
-
-	char* const path = GetBuRAMPath(filename);
+	BuRAMFile* const index_file = BuRAMIndex_Find(filename);
 
 	(void)user_data;
 
-	if (path != NULL)
+	if (index_file == NULL)
+		return cc_false;
+
+	if (index_file->status == BURAM_FILE_STATUS_UNKNOWN)
 	{
-		struct retro_vfs_file_handle* const file = file_io.open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+		struct retro_vfs_file_handle* const file = file_io.open(index_file->path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
 
-		if (file != NULL)
+		if (file == NULL)
 		{
-			*size = file_io.get_size(file);
-			success = cc_true;
+			if (FileIsMissing(index_file->path))
+				BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_MISSING, 0);
+		}
+		else
+		{
+			const int64_t file_size = file_io.get_size(file);
+
+			/* Leave the status as unknown if the size could not be obtained, so that it is tried again next time. */
+			if (file_size >= 0)
+				BuRAMIndex_SetStatus(index_file, BURAM_FILE_STATUS_PRESENT, (size_t)file_size);
 
 			file_io.close(file);
-		}
 
-		free(path);
+			if (file_size < 0)
+				return cc_false;
+		}
 	}
 
+	if (index_file->status != BURAM_FILE_STATUS_PRESENT)
+		return cc_false;
 
-	return success;
+	*size = index_file->size;
+	return cc_true;
 }
 
 /***********/
@@ -608,6 +1557,16 @@ CC_ATTRIBUTE_PRINTF(2, 3) static void FallbackErrorLogCallback(const enum retro_
 	va_end(args);
 }
 
+static retro_time_t FallbackGetTimeUsecCallback(void)
+{
+	return (retro_time_t)((double)clock() * 1000000.0 / CLOCKS_PER_SEC);
+}
+
+static uint64_t FallbackGetCPUFeaturesCallback(void)
+{
+	return 0;
+}
+
 static void ClownCDLog(void* const user_data, const char* const message)
 {
 	(void)user_data;
@@ -630,6 +1589,135 @@ static void ClownMDEmuLog(void* const user_data, const char* const format, va_li
 	libretro_callbacks.log(RETRO_LOG_WARN, "%s", message_buffer);
 }
 
+/*************/
+/* Frameskip */
+/*************/
+
+static void RETRO_CALLCONV AudioBufferStatusCallback(const bool active, const unsigned int occupancy, const bool underrun_likely)
+{
+	frameskip.audio_buffer_active = active;
+	frameskip.audio_buffer_occupancy = occupancy;
+	frameskip.audio_buffer_underrun_likely = underrun_likely;
+}
+
+static cc_bool Frameskip_ShouldSkipFrame(void)
+{
+	cc_bool skip;
+
+	switch (frameskip.mode)
+	{
+		default:
+		case FRAMESKIP_MODE_DISABLED:
+			return cc_false;
+
+		case FRAMESKIP_MODE_AUTO:
+			skip = frameskip.audio_buffer_active && frameskip.audio_buffer_underrun_likely;
+			break;
+
+		case FRAMESKIP_MODE_THRESHOLD:
+			skip = frameskip.audio_buffer_active && frameskip.audio_buffer_occupancy < frameskip.threshold;
+			break;
+
+		case FRAMESKIP_MODE_FIXED:
+			skip = cc_true;
+			break;
+	}
+
+	/* Never skip so many frames in a row that the game appears to freeze. */
+	if (skip && frameskip.frames_skipped < frameskip.interval)
+	{
+		++frameskip.frames_skipped;
+		return cc_true;
+	}
+
+	frameskip.frames_skipped = 0;
+	return cc_false;
+}
+
+static void Frameskip_Configure(const FrameskipMode mode, const cc_u8f threshold, const cc_u8f interval)
+{
+	/* Skipped frames are sent as duplicates, which the frontend must support. */
+	frameskip.mode = frontend_can_dupe ? mode : FRAMESKIP_MODE_DISABLED;
+	frameskip.threshold = threshold;
+	frameskip.interval = interval;
+
+	/* Only ask for the audio buffer status when it is needed. */
+	if ((frameskip.mode == FRAMESKIP_MODE_AUTO || frameskip.mode == FRAMESKIP_MODE_THRESHOLD) != frameskip.callback_registered)
+	{
+		struct retro_audio_buffer_status_callback callback;
+		unsigned int minimum_latency;
+
+		callback.callback = frameskip.callback_registered ? NULL : AudioBufferStatusCallback;
+
+		if (libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, (void*)&callback))
+		{
+			frameskip.callback_registered = !frameskip.callback_registered;
+
+			/* The audio buffer needs to be large enough for its occupancy to be meaningful. Six frames is what other cores use. */
+			minimum_latency = frameskip.callback_registered ? 6 * 1000 / (pal_mode_enabled ? 50 : 60) : 0;
+			libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_MINIMUM_AUDIO_LATENCY, (void*)&minimum_latency);
+		}
+		else if (!frameskip.callback_registered)
+		{
+			libretro_callbacks.log(RETRO_LOG_WARN, "Frontend does not report its audio buffer status: frameskip disabled.\n");
+			frameskip.mode = FRAMESKIP_MODE_DISABLED;
+		}
+
+		frameskip.audio_buffer_active = cc_false;
+	}
+}
+
+/**********/
+/* Rewind */
+/**********/
+
+static void RewindBuffer_Free(void)
+{
+	if (rewind_buffer.history != NULL)
+	{
+		Rewind_Destroy(rewind_buffer.history);
+		rewind_buffer.history = NULL;
+	}
+
+	free(rewind_buffer.state);
+	rewind_buffer.state = NULL;
+	rewind_buffer.state_capacity = 0;
+	rewind_buffer.budget = 0;
+}
+
+static void RewindBuffer_Snapshot(void)
+{
+	const retro_time_t start_time = libretro_callbacks.get_time_usec();
+	const size_t state_size = retro_serialize_size();
+
+	if (state_size > rewind_buffer.state_capacity)
+	{
+		unsigned char* const state = (unsigned char*)realloc(rewind_buffer.state, state_size);
+
+		if (state == NULL)
+			return;
+
+		rewind_buffer.state = state;
+		rewind_buffer.state_capacity = state_size;
+	}
+
+	if (!retro_serialize(rewind_buffer.state, state_size))
+		return;
+
+	rewind_buffer.snapshot_bytes += Rewind_Push(rewind_buffer.history, rewind_buffer.state, state_size);
+	rewind_buffer.state_size = state_size;
+	rewind_buffer.snapshot_time += libretro_callbacks.get_time_usec() - start_time;
+
+	if (++rewind_buffer.total_frames == 60 * 10)
+	{
+		libretro_callbacks.log(RETRO_LOG_DEBUG, "Rewind: %lu bytes per frame, %ldus per snapshot, for a %lu byte state.\n", rewind_buffer.snapshot_bytes / (unsigned long)rewind_buffer.total_frames, (long)(rewind_buffer.snapshot_time / (retro_time_t)rewind_buffer.total_frames), (unsigned long)state_size);
+
+		rewind_buffer.snapshot_time = 0;
+		rewind_buffer.snapshot_bytes = 0;
+		rewind_buffer.total_frames = 0;
+	}
+}
+
 /***********/
 /* Options */
 /***********/
@@ -670,6 +1758,58 @@ static ControllerManager_Protocol DoOptionInputProtocol(const char* const key)
 	return CONTROLLER_MANAGER_PROTOCOL_STANDARD;
 }
 
+static InputPollingMode DoOptionInputPollingMode(const char* const key)
+{
+	struct retro_variable variable;
+
+	variable.key = key;
+	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_VARIABLE, (void*)&variable) && variable.value != NULL)
+	{
+		if (strcmp(variable.value, "late") == 0)
+			return INPUT_POLLING_MODE_LATE;
+		if (strcmp(variable.value, "continuous") == 0)
+			return INPUT_POLLING_MODE_CONTINUOUS;
+	}
+
+	return INPUT_POLLING_MODE_EARLY;
+}
+
+static FrameskipMode DoOptionFrameskipMode(const char* const key)
+{
+	struct retro_variable variable;
+
+	variable.key = key;
+	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_VARIABLE, (void*)&variable) && variable.value != NULL)
+	{
+		if (strcmp(variable.value, "auto") == 0)
+			return FRAMESKIP_MODE_AUTO;
+		if (strcmp(variable.value, "threshold") == 0)
+			return FRAMESKIP_MODE_THRESHOLD;
+		if (strcmp(variable.value, "fixed") == 0)
+			return FRAMESKIP_MODE_FIXED;
+	}
+
+	return FRAMESKIP_MODE_DISABLED;
+}
+
+static ColourConversionMode DoOptionColourConversionMode(const char* const key)
+{
+	struct retro_variable variable;
+
+	variable.key = key;
+	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_VARIABLE, (void*)&variable) && variable.value != NULL)
+	{
+		if (strcmp(variable.value, "scanline") == 0)
+			return COLOUR_CONVERSION_MODE_SCANLINE;
+		if (strcmp(variable.value, "frame") == 0)
+			return COLOUR_CONVERSION_MODE_FRAME;
+		if (strcmp(variable.value, "threaded") == 0)
+			return COLOUR_CONVERSION_MODE_THREADED;
+	}
+
+	return COLOUR_CONVERSION_MODE_SCANLINE;
+}
+
 static void UpdateOptions(const cc_bool only_update_flags)
 {
 	const cc_bool pal_mode_changed = pal_mode_enabled != DoOptionBoolean("clownmdemu_tv_standard", "pal");
@@ -689,10 +1829,92 @@ static void UpdateOptions(const cc_bool only_update_flags)
 	}
 
 	Geometry_SetTallInterlaceMode2(DoOptionBoolean("clownmdemu_tall_interlace_mode_2", "enabled"));
+	colour_conversion_mode = DoOptionColourConversionMode("clownmdemu_colour_conversion");
+	input_polling.mode = DoOptionInputPollingMode("clownmdemu_input_polling");
+	input_polling.minimum_interval = (retro_time_t)DoOptionNumerical("clownmdemu_input_polling_interval") * 1000;
+
+	/* Only keep the conversion thread around for as long as it is needed. */
+	if (colour_conversion_mode == COLOUR_CONVERSION_MODE_THREADED)
+	{
+		if (conversion_thread.worker == NULL)
+		{
+			conversion_thread.worker = WorkerThread_Create(ConversionThreadCallback, NULL);
+
+			if (conversion_thread.worker == NULL)
+			{
+				libretro_callbacks.log(RETRO_LOG_WARN, "Could not create colour conversion thread: falling back on converting whole frames.\n");
+				colour_conversion_mode = COLOUR_CONVERSION_MODE_FRAME;
+			}
+		}
+	}
+	else if (conversion_thread.worker != NULL)
+	{
+		WorkerThread_Destroy(conversion_thread.worker);
+		conversion_thread.worker = NULL;
+	}
+
+	{
+		bool can_dupe;
+		frontend_can_dupe = libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_CAN_DUPE, (void*)&can_dupe) && can_dupe;
+		/* The deferred conversion modes keep a copy of each scanline anyway, so only they can spot duplicates for free. */
+		duplicate_frames_allowed = frontend_can_dupe && colour_conversion_mode != COLOUR_CONVERSION_MODE_SCANLINE && DoOptionBoolean("clownmdemu_duplicate_frames", "enabled");
+	}
+
+	state_hash.logging_enabled = DoOptionBoolean("clownmdemu_log_state_hash", "enabled");
+
+	/* The benchmark is run whenever the option is switched on. */
+	{
+		const cc_bool benchmark_enabled = DoOptionBoolean("clownmdemu_benchmark_pixel_conversion", "enabled");
+
+		if (benchmark_enabled && !pixel_conversion_benchmark_enabled)
+			PixelConversion_Benchmark(libretro_callbacks.get_cpu_features());
+
+		pixel_conversion_benchmark_enabled = benchmark_enabled;
+	}
+
+	cd_read_ahead.enabled = DoOptionBoolean("clownmdemu_cd_read_ahead", "enabled");
+	cdda_decode_ahead.enabled = DoOptionBoolean("clownmdemu_cdda_decode_ahead", "enabled");
+	disc_cache.size_limit = (unsigned long)DoOptionNumerical("clownmdemu_disc_cache");
+	disc_preload.enabled = DoOptionBoolean("clownmdemu_disc_preload", "enabled");
+	disc_block_size = (size_t)DoOptionNumerical("clownmdemu_disc_block_size") * 1024;
+	cd_turbo.maximum_factor = DoOptionNumerical("clownmdemu_cd_loading_turbo");
+	UpdateCDReadAhead();
+
+	fast_forward.render_interval = DoOptionNumerical("clownmdemu_fast_forward_frameskip");
+	fast_forward.enabled = fast_forward.render_interval != 0;
+
+	/* Frames can only be skipped if the frontend can reuse the previous one. */
+	if (!frontend_can_dupe)
+		fast_forward.render_interval = 1;
+
+	/* The history is created afresh whenever its budget changes. */
+	{
+		const size_t rewind_budget = (size_t)DoOptionNumerical("clownmdemu_rewind_buffer") * 1024 * 1024;
+
+		if (rewind_budget != rewind_buffer.budget)
+		{
+			RewindBuffer_Free();
+
+			if (rewind_budget != 0)
+			{
+				rewind_buffer.history = Rewind_Create(rewind_budget);
+
+				if (rewind_buffer.history == NULL)
+					libretro_callbacks.log(RETRO_LOG_WARN, "Could not allocate %luMiB for the rewind buffer.\n", (unsigned long)(rewind_budget / (1024 * 1024)));
+			}
+
+			rewind_buffer.budget = rewind_budget;
+		}
+	}
+
+	Frameskip_Configure(DoOptionFrameskipMode("clownmdemu_frameskip"), DoOptionNumerical("clownmdemu_frameskip_threshold"), DoOptionNumerical("clownmdemu_frameskip_interval"));
+
+	/* Options may affect the output, so do not reuse the previous frame. */
+	indexed_frame.frame_changed = cc_true;
 
 	clownmdemu.configuration.region                           =  DoOptionBoolean("clownmdemu_overseas_region", "elsewhere") ? CLOWNMDEMU_REGION_OVERSEAS : CLOWNMDEMU_REGION_DOMESTIC;
 	clownmdemu.configuration.tv_standard                      =  pal_mode_enabled ? CLOWNMDEMU_TV_STANDARD_PAL : CLOWNMDEMU_TV_STANDARD_NTSC;
-	clownmdemu.configuration.low_pass_filter_disabled         = !DoOptionBoolean("clownmdemu_lowpass_filter", "enabled");
+	clownmdemu.configuration.low_pass_filter_disabled         = !DoOptionBoolean("clownmdemu_lowpass_filter", "enabled") || fast_forward.active;
 	clownmdemu.configuration.cd_add_on_enabled                =  DoOptionBoolean("clownmdemu_cd_addon", "enabled");
 	clownmdemu.controller_manager.configuration.protocol      =  DoOptionInputProtocol("clownmdemu_input_protocol");
 	clownmdemu.vdp.configuration.sprites_disabled             =  DoOptionBoolean("clownmdemu_disable_sprite_plane", "enabled");
@@ -723,6 +1945,253 @@ static void UpdateOptions(const cc_bool only_update_flags)
 	clownmdemu.mega_cd.cdda.configuration.disabled            =  DoOptionBoolean("clownmdemu_disable_cdda", "enabled");
 }
 
+/*****************/
+/* Serialisation */
+/*****************/
+
+/* States begin with this header, so that states from other versions, or for other kinds of content, can be rejected safely. */
+#define SERIALISED_STATE_VERSION 1
+
+#define SERIALISED_STATE_FLAG_MEGA_CD   (1 << 0) /* The core section includes the Mega CD's memory. */
+#define SERIALISED_STATE_FLAG_CD_READER (1 << 1) /* A CD reader section follows the core section. */
+
+typedef struct SerialisedStateHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t core_section_size;
+	uint32_t cd_reader_section_size;
+	uint32_t cd_turbo_state; /* Zero if there is no CD reader section. */
+	uint32_t frame_counter; /* Also pads the header so that the sections that follow are suitably aligned. Zero in states from older builds. */
+} SerialisedStateHeader;
+
+static const char serialised_state_magic[8] = {'C', 'L', 'O', 'W', 'N', 'M', 'D', 'S'};
+
+/* While audio is being decoded ahead, 'cd_reader' does not know the position within the track, so the section holds
+   the state that the decoder's current chunk was decoded from, and how many frames into the chunk playback is. */
+typedef struct SerialisedCDReaderState
+{
+	CDReader_StateBackup backup;
+	uint32_t audio_frame_offset;
+} SerialisedCDReaderState;
+
+/* A region of emulator memory, and where it is placed within a 'ClownMDEmu_StateBackup'. */
+typedef struct StateRegion
+{
+	unsigned char *memory;
+	size_t size;
+	size_t backup_offset;
+} StateRegion;
+
+static ClownMDEmu_StateBackup state_backup_scratch;
+
+/* The Mega CD's PRG-RAM and Word-RAM, sorted by backup offset. These dwarf the rest of the state, but are unused by cartridge-only games. */
+static StateRegion mega_cd_state_regions[2];
+
+static void InitialiseStateRegion(StateRegion* const region, void* const memory, const size_t size, const size_t backup_offset)
+{
+	region->memory = (unsigned char*)memory;
+	region->size = size;
+	region->backup_offset = backup_offset;
+}
+
+static void InitialiseStateRegions(void)
+{
+	/* The backup holds a copy of 'clownmdemu.state'. */
+	InitialiseStateRegion(&mega_cd_state_regions[0], clownmdemu.state.mega_cd.prg_ram.buffer, sizeof(clownmdemu.state.mega_cd.prg_ram.buffer), offsetof(ClownMDEmu_StateBackup, state.mega_cd.prg_ram.buffer));
+	InitialiseStateRegion(&mega_cd_state_regions[1], clownmdemu.state.mega_cd.word_ram.buffer, sizeof(clownmdemu.state.mega_cd.word_ram.buffer), offsetof(ClownMDEmu_StateBackup, state.mega_cd.word_ram.buffer));
+
+	if (mega_cd_state_regions[0].backup_offset > mega_cd_state_regions[1].backup_offset)
+	{
+		const StateRegion temporary = mega_cd_state_regions[0];
+		mega_cd_state_regions[0] = mega_cd_state_regions[1];
+		mega_cd_state_regions[1] = temporary;
+	}
+}
+
+/* Decided when the game is loaded, so that the size of the state does not change while the game is running. */
+static uint32_t serialised_state_flags;
+
+static uint32_t GetSerialisedStateFlags(void)
+{
+	uint32_t flags = 0;
+
+	if (CDReader_IsOpen(&cd_reader))
+		flags |= SERIALISED_STATE_FLAG_MEGA_CD | SERIALISED_STATE_FLAG_CD_READER;
+	else if (clownmdemu.configuration.cd_add_on_enabled)
+		flags |= SERIALISED_STATE_FLAG_MEGA_CD;
+
+	return flags;
+}
+
+static size_t GetCoreSectionSize(const uint32_t flags)
+{
+	size_t size = sizeof(ClownMDEmu_StateBackup);
+
+	if ((flags & SERIALISED_STATE_FLAG_MEGA_CD) == 0)
+	{
+		size_t i;
+
+		for (i = 0; i < CC_COUNT_OF(mega_cd_state_regions); ++i)
+			size -= mega_cd_state_regions[i].size;
+	}
+
+	return size;
+}
+
+static size_t GetSerialisedStateSize(const uint32_t flags)
+{
+	return sizeof(SerialisedStateHeader) + GetCoreSectionSize(flags) + ((flags & SERIALISED_STATE_FLAG_CD_READER) != 0 ? sizeof(SerialisedCDReaderState) : 0);
+}
+
+static void SaveCDReaderState(SerialisedCDReaderState* const state)
+{
+	cc_u32f audio_frame_offset;
+
+	/* Zeroed, so that the padding is consistent for the state hash. */
+	memset(state, 0, sizeof(*state));
+
+	/* Taking the decoder's position avoids decoding the played frames a second time. */
+	if (cdda_decode_ahead.decode_ahead != NULL && CDDADecodeAhead_GetPosition(cdda_decode_ahead.decode_ahead, &state->backup, &audio_frame_offset))
+	{
+		state->audio_frame_offset = audio_frame_offset;
+	}
+	else
+	{
+		SynchroniseCDReaderSector();
+		CDReader_SaveState(&cd_reader, &state->backup);
+		state->audio_frame_offset = 0;
+	}
+}
+
+static void LoadCDReaderState(const CDReader_StateBackup* const backup, const cc_u32f audio_frame_offset)
+{
+	CDReader_LoadState(&cd_reader, backup);
+
+	/* The reader's position is unknown until the next seek. */
+	cd_read_ahead.reader_stale = cc_false;
+	disc_cache.positioned = cc_false;
+
+	if (cd_read_ahead.read_ahead != NULL)
+		CDReadAhead_Invalidate(cd_read_ahead.read_ahead);
+
+	/* Audio, however, carries on from where the state left it. If the decoder has already decoded that far, it does not start over. */
+	if (cdda_decode_ahead.decode_ahead != NULL)
+		CDDADecodeAhead_Start(cdda_decode_ahead.decode_ahead, backup, audio_frame_offset);
+	else
+		SkipCDReaderAudio(audio_frame_offset);
+}
+
+/* States from before the header was added are a bare 'ClownMDEmu_StateBackup', which is followed by the CD reader's state in all but the oldest builds. */
+typedef struct LegacySerialisedState
+{
+	ClownMDEmu_StateBackup clownmdemu;
+	CDReader_StateBackup cd_reader;
+} LegacySerialisedState;
+
+static bool UnserialiseLegacyState(const void* const data, const size_t size)
+{
+	const LegacySerialisedState* const legacy_state = (const LegacySerialisedState*)data;
+
+	if (size != sizeof(LegacySerialisedState) && size != sizeof(ClownMDEmu_StateBackup))
+	{
+		libretro_callbacks.log(RETRO_LOG_ERROR, "Save state is not from this version of the core.\n");
+		return false;
+	}
+
+	ClownMDEmu_LoadState(&clownmdemu, &legacy_state->clownmdemu);
+
+	if (size == sizeof(LegacySerialisedState) && CDReader_IsOpen(&cd_reader))
+	{
+		LoadCDReaderState(&legacy_state->cd_reader, 0);
+
+		/* These states do not say whether the game was loading, so wait for loading to be detected again. */
+		CDTurbo_Reset();
+	}
+	else
+	{
+		CDTurbo_Restart();
+	}
+
+	return true;
+}
+
+/**************/
+/* State Hash */
+/**************/
+
+static uint64_t MixHash(uint64_t value)
+{
+	/* The SplitMix64 finaliser. */
+	value ^= value >> 30;
+	value *= (uint64_t)0xBF58476D << 32 | 0x1CE4E5B9;
+	value ^= value >> 27;
+	value *= (uint64_t)0x94D049BB << 32 | 0x133111EB;
+	value ^= value >> 31;
+	return value;
+}
+
+static uint64_t HashBytes(const unsigned char* const bytes, const size_t length)
+{
+	const uint64_t multiplier = (uint64_t)0x9E3779B9 << 32 | 0x7F4A7C15;
+
+	uint64_t hash = length;
+	size_t i;
+
+	for (i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, &bytes[i], sizeof(word));
+		hash = (hash ^ word) * multiplier;
+		hash ^= hash >> 29;
+	}
+
+	for (; i < length; ++i)
+		hash = (hash ^ bytes[i]) * multiplier;
+
+	return hash;
+}
+
+static uint64_t StateHash_Compute(void)
+{
+	/* The emulator's state is hashed where it is, rather than being saved first. The CD reader is left out, as saving its state would move it.
+	   Like the serialised state, the digest is only comparable between builds for the same platform. */
+	const unsigned char* const state = (const unsigned char*)&clownmdemu.state;
+
+	uint64_t digest = state_hash.frame_counter;
+	size_t position = 0;
+
+	/* The Mega CD's memory is left out when it is not serialised, as it is then unused. */
+	if ((serialised_state_flags & SERIALISED_STATE_FLAG_MEGA_CD) == 0)
+	{
+		size_t i;
+
+		for (i = 0; i < CC_COUNT_OF(mega_cd_state_regions); ++i)
+		{
+			const size_t offset = (size_t)(mega_cd_state_regions[i].memory - state);
+
+			digest = MixHash(digest) + HashBytes(&state[position], offset - position);
+			position = offset + mega_cd_state_regions[i].size;
+		}
+	}
+
+	digest = MixHash(digest) + HashBytes(&state[position], sizeof(clownmdemu.state) - position);
+
+	return MixHash(digest);
+}
+
+static void StateHash_EndFrame(void)
+{
+	++state_hash.frame_counter;
+
+	if (state_hash.logging_enabled)
+	{
+		const uint64_t digest = StateHash_Compute();
+		libretro_callbacks.log(RETRO_LOG_INFO, "Frame %lu state hash: %08lX%08lX\n", state_hash.frame_counter, (unsigned long)(digest >> 32), (unsigned long)(digest & 0xFFFFFFFF));
+	}
+}
+
 /****************/
 /* libretro API */
 /****************/
@@ -731,6 +2200,10 @@ void retro_init(void)
 {
 	LoadFileIOCallbacks();
 
+	pixel_conversion_kernel = PixelConversion_SelectKernel(libretro_callbacks.get_cpu_features());
+
+	input_cache.bitmasks_supported = libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_INPUT_BITMASKS, NULL);
+
 	/* Inform frontend of serialisation quirks. */
 	{
 		uint64_t serialisation_quirks = RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT | RETRO_SERIALIZATION_QUIRK_PLATFORM_DEPENDENT;
@@ -768,6 +2241,8 @@ void retro_init(void)
 		ClownMDEmu_Initialise(&clownmdemu, &configuration, &clownmdemu_callbacks);
 	}
 
+	InitialiseStateRegions();
+
 	UpdateOptions(cc_true);
 
 	/* Initialise the mixer. */
@@ -778,8 +2253,20 @@ void retro_init(void)
 
 void retro_deinit(void)
 {
+	if (conversion_thread.worker != NULL)
+	{
+		WorkerThread_Destroy(conversion_thread.worker);
+		conversion_thread.worker = NULL;
+	}
+
 	CDReader_Deinitialise(&cd_reader);
 	Mixer_Deinitialise(&mixer);
+
+	free(frame_output.discarded_samples);
+	frame_output.discarded_samples = NULL;
+	frame_output.discarded_samples_capacity = 0;
+
+	RewindBuffer_Free();
 }
 
 unsigned int retro_api_version(void)
@@ -820,7 +2307,7 @@ void retro_get_system_av_info(struct retro_system_av_info* const info)
 	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, (void*)&pixel_format))
 	{
 		fallback_colour_updated_callback = ColourUpdatedCallback_RGB565;
-		fallback_scanline_rendered_callback = ScanlineRenderedCallback_16Bit;
+		fallback_convert_scanline = ConvertScanline_16Bit;
 	}
 	else
 	{
@@ -828,12 +2315,12 @@ void retro_get_system_av_info(struct retro_system_av_info* const info)
 		if (libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, (void*)&pixel_format))
 		{
 			fallback_colour_updated_callback = ColourUpdatedCallback_XRGB8888;
-			fallback_scanline_rendered_callback = ScanlineRenderedCallback_32Bit;
+			fallback_convert_scanline = ConvertScanline_32Bit;
 		}
 		else
 		{
 			fallback_colour_updated_callback = ColourUpdatedCallback_0RGB1555;
-			fallback_scanline_rendered_callback = ScanlineRenderedCallback_16Bit;
+			fallback_convert_scanline = ConvertScanline_16Bit;
 		}
 	}
 
@@ -863,6 +2350,23 @@ void retro_set_environment(const retro_environment_t environment_callback)
 			libretro_callbacks.log = FallbackErrorLogCallback;
 	}
 
+	/* Retrieve timing and CPU feature detection callbacks from the frontend. */
+	{
+		struct retro_perf_callback perf;
+
+		libretro_callbacks.get_time_usec = FallbackGetTimeUsecCallback;
+		libretro_callbacks.get_cpu_features = FallbackGetCPUFeaturesCallback;
+
+		if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, (void*)&perf))
+		{
+			if (perf.get_time_usec != NULL)
+				libretro_callbacks.get_time_usec = perf.get_time_usec;
+
+			if (perf.get_cpu_features != NULL)
+				libretro_callbacks.get_cpu_features = perf.get_cpu_features;
+		}
+	}
+
 	/* TODO: Specialised controller types. */
 	{
 		/*static const struct retro_controller_description controllers[] = {
@@ -925,9 +2429,14 @@ void retro_set_environment(const retro_environment_t environment_callback)
 	}
 
 	/* Allow Mega Drive games to be soft-patched by the frontend. */
+	/* On big-endian CPUs, the ROM does not need byte-swapping, so the frontend is asked to keep its copy until the game is unloaded, which then gets used directly. */
 	{
 		static const struct retro_system_content_info_override overrides[] = {
+#if RETRO_IS_BIG_ENDIAN
+			{ CARTRIDGE_FILE_EXTENSIONS, false, true },
+#else
 			{ CARTRIDGE_FILE_EXTENSIONS, false, false },
+#endif
 			{ NULL, false, false }
 		};
 
@@ -971,35 +2480,136 @@ void retro_reset(void)
 	ClownMDEmu_SoftReset(&clownmdemu, rom != NULL, CDReader_IsOpen(&cd_reader));
 }
 
-static void MixerCompleteCallback(void* const user_data, const cc_s16l* const audio_samples, const size_t total_frames)
+static cc_bool FastForward_Update(void)
 {
-	(void)user_data;
+	bool fast_forwarding;
+	const cc_bool active = fast_forward.enabled && libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_FASTFORWARDING, (void*)&fast_forwarding) && fast_forwarding;
+
+	if (fast_forward.active != active)
+	{
+		fast_forward.active = active;
+		fast_forward.frame_counter = 0;
+
+		/* The low-pass filter is bypassed while fast-forwarding, and restored to the user's setting afterwards. */
+		clownmdemu.configuration.low_pass_filter_disabled = !DoOptionBoolean("clownmdemu_lowpass_filter", "enabled") || active;
+	}
+
+	/* Returns whether this frame should be skipped. */
+	if (!fast_forward.active)
+		return cc_false;
 
-	libretro_callbacks.audio_batch(audio_samples, total_frames);
+	if (++fast_forward.frame_counter >= fast_forward.render_interval)
+	{
+		fast_forward.frame_counter = 0;
+		return cc_false;
+	}
+
+	return cc_true;
 }
 
 void retro_run(void)
 {
 	bool options_updated;
+	cc_bool frame_is_shown;
 
 	/* Refresh options if they've been updated. */
 	if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, (void*)&options_updated) && options_updated)
 		UpdateOptions(cc_false);
 
-	/* Poll inputs. */
-	libretro_callbacks.input_poll();
+	/* Poll inputs, unless this is to be done when the game reads them. */
+	input_polling.polled_this_frame = cc_false;
+
+	if (input_polling.mode == INPUT_POLLING_MODE_EARLY)
+		PollInput();
+
+	/* Skip work whose output the frontend would throw away, such as during run-ahead and netplay. */
+	{
+		int audio_video_enable;
+
+		if (!libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, (void*)&audio_video_enable))
+			audio_video_enable = 1 | 2;
 
-	Mixer_Begin(&mixer);
+		frame_is_shown = (audio_video_enable & 1) != 0;
+
+		/* A skipped frame is sent as a duplicate of the previous one, which only frontends that can reuse it allow. Otherwise, every frame is rendered. */
+		frame_output.skip_video = !frame_is_shown && frontend_can_dupe;
+		frame_output.skip_audio = (audio_video_enable & 2) == 0;
+
+		Replay_Update(audio_video_enable);
+	}
+
+	/* Frameskip only affects video: audio is needed to keep the frontend's buffer filled. */
+	if (Frameskip_ShouldSkipFrame())
+		frame_output.skip_video = cc_true;
+
+	if (FastForward_Update())
+		frame_output.skip_video = cc_true;
+
+	CDTurbo_RunExtraFrames();
+
+	frame_output.mixer_in_use = !frame_output.skip_audio;
+
+	if (frame_output.mixer_in_use)
+		Mixer_Begin(&mixer);
 
 	CheatManager_ApplyRAMPatches(&cheat_manager, &clownmdemu);
 	ClownMDEmu_Iterate(&clownmdemu);
 
-	Mixer_End(&mixer, MixerCompleteCallback, NULL);
+	/* The frontend expects inputs to be polled at least once per frame, even if the game did not read them. */
+	if (!input_polling.polled_this_frame)
+		PollInput();
+
+	if (frame_output.mixer_in_use)
+		Mixer_End(&mixer, MixerCompleteCallback, NULL);
 
 	Geometry_Update();
 
-	/* Upload the completed frame to the frontend. */
-	libretro_callbacks.video(current_framebuffer, geometry.current_screen_width, geometry.current_screen_height, current_framebuffer_pitch);
+	/* The framebuffer is not complete until the conversion thread has caught up. */
+	if (colour_conversion_mode == COLOUR_CONVERSION_MODE_THREADED)
+		ConversionThread_Finish();
+
+	if (frame_output.skip_video)
+	{
+		/* Whatever the frontend has now, the next rendered frame must not be treated as a duplicate of it. */
+		indexed_frame.frame_changed = cc_true;
+
+		libretro_callbacks.video(NULL, geometry.current_screen_width, geometry.current_screen_height, 0);
+	}
+	/* Upload the completed frame to the frontend, unless it is identical to the previous one. */
+	else if (indexed_frame.frame_changed || !duplicate_frames_allowed)
+	{
+		if (colour_conversion_mode == COLOUR_CONVERSION_MODE_FRAME)
+			IndexedFrame_Convert();
+
+		libretro_callbacks.video(current_framebuffer, geometry.current_screen_width, geometry.current_screen_height, current_framebuffer_pitch);
+
+		indexed_frame.frame_changed = cc_false;
+	}
+	else
+	{
+		libretro_callbacks.video(NULL, geometry.current_screen_width, geometry.current_screen_height, current_framebuffer_pitch);
+	}
+
+	if (rewind_buffer.history != NULL)
+	{
+		/* Frames that run-ahead or netplay may replace are not part of the history, and the history must lead up to the current frame. */
+		if (Replay_IsActive())
+			Rewind_Clear(rewind_buffer.history);
+		else if (!rewind_buffer.stepped)
+			RewindBuffer_Snapshot();
+	}
+
+	rewind_buffer.stepped = cc_false;
+
+	CDLoading_EndFrame();
+
+	if (disc_cache.builder != NULL && DiscCacheBuilder_Update(disc_cache.builder))
+	{
+		DiscCacheBuilder_Destroy(disc_cache.builder);
+		disc_cache.builder = NULL;
+	}
+
+	StateHash_EndFrame();
 }
 
 #if RETRO_IS_BIG_ENDIAN
@@ -1031,40 +2641,214 @@ static void SetMemoryMaps(const cc_u16l* const rom, const size_t rom_length)
 	libretro_callbacks.environment(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, (void*)&memory_maps);
 }
 
-static bool LoadCartridge(const struct retro_game_info* const info)
+static bool LoadCartridge(const struct retro_game_info* const info, const size_t content_index)
 {
-	const unsigned char *buffer = (const unsigned char*)info->data;
+	unsigned char *file_buffer = NULL;
 	size_t buffer_size = info->size;
+	bool buffer_is_mapped = false;
+	size_t total_words;
+
+#if RETRO_IS_BIG_ENDIAN
+	/* The ROM is already in the native byte order, so the frontend's copy of it can be used directly if it will outlive the game. */
+	if (info->data != NULL && sizeof(cc_u16l) == 2)
+	{
+		const struct retro_game_info_ext *info_ext;
+
+		if (libretro_callbacks.environment(RETRO_ENVIRONMENT_GET_GAME_INFO_EXT, (void*)&info_ext) && info_ext != NULL
+		 && info_ext[content_index].persistent_data && info_ext[content_index].data == info->data)
+		{
+			rom = (cc_u16l*)info->data;
+			rom_length = info->size / 2;
+			rom_is_frontend_owned = cc_true;
+
+			ClownMDEmu_SetCartridge(&clownmdemu, rom, rom_length);
+			return true;
+		}
+	}
+#else
+	(void)content_index;
+#endif
+
+	/* On big-endian CPUs, the file can be mapped into memory and used as-is. Elsewhere, byte-swapping the mapping would copy every page of it anyway,
+	   so the file is read into a buffer instead. Files that are only read, such as BuRAM files and the disc cache, are mapped on every CPU. */
+#if RETRO_IS_BIG_ENDIAN
+	if (info->data == NULL && !LoadFileToBuffer(info->path, &file_buffer, &buffer_size, &buffer_is_mapped))
+		return false;
+#else
+	if (info->data == NULL && !LoadFileToBuffer(info->path, &file_buffer, &buffer_size, NULL))
+		return false;
+#endif
+
+	total_words = buffer_size / 2;
+
+	/* Convert the file buffer in-place where possible, so that only one copy of the ROM is ever in memory. */
+	if (file_buffer != NULL && sizeof(cc_u16l) == 2)
+	{
+		rom = (cc_u16l*)file_buffer;
+
+		if (buffer_is_mapped)
+			rom_mapped_size = buffer_size;
+	}
+	else
+	{
+		rom = (cc_u16l*)malloc(total_words * sizeof(cc_u16l));
+
+		if (rom == NULL)
+		{
+			FreeFileBuffer(file_buffer, buffer_size, buffer_is_mapped);
+			return false;
+		}
+	}
+
+	ConvertROMWords(rom, file_buffer != NULL ? file_buffer : (const unsigned char*)info->data, total_words);
+	rom_length = total_words;
 
-	unsigned char *local_rom_buffer = NULL;
+	if ((void*)rom != (void*)file_buffer)
+		FreeFileBuffer(file_buffer, buffer_size, buffer_is_mapped);
 
-	if (buffer == NULL && LoadFileToBuffer(info->path, &local_rom_buffer, &buffer_size))
-		buffer = local_rom_buffer;
+	ClownMDEmu_SetCartridge(&clownmdemu, rom, rom_length);
+	return true;
+}
 
-	if (buffer != NULL && CreateROMBuffer(buffer, buffer_size, &rom, &rom_length))
+static cc_bool MakeROMWritable(void)
+{
+	/* Cheats patch the ROM, which cannot be done to the frontend's copy of it. */
+	if (rom_is_frontend_owned)
 	{
+		cc_u16l* const copy = (cc_u16l*)malloc(rom_length * sizeof(cc_u16l));
+
+		if (copy == NULL)
+			return cc_false;
+
+		memcpy(copy, rom, rom_length * sizeof(cc_u16l));
+
+		rom = copy;
+		rom_is_frontend_owned = cc_false;
+
 		ClownMDEmu_SetCartridge(&clownmdemu, rom, rom_length);
-		return true;
 	}
 
-	free(local_rom_buffer);
-	return false;
+	return cc_true;
+}
+
+static cc_bool IsCHDFile(const char* const path)
+{
+	const char* const extension = strrchr(path, '.');
+
+	return extension != NULL
+		&& (extension[1] == 'c' || extension[1] == 'C')
+		&& (extension[2] == 'h' || extension[2] == 'H')
+		&& (extension[3] == 'd' || extension[3] == 'D')
+		&& extension[4] == '\0';
 }
 
 static bool LoadCD(const struct retro_game_info* const info)
 {
-	if (info->data != NULL)
+	/* Cartridges may be provided as data, but discs are always read from their files. */
+	if (info->path == NULL)
 		return false;
 
-	CDReader_Open(&cd_reader, NULL, info->path, &clowncd_callbacks);
+	ClownCDCallbacks_SetBlockSize(disc_block_size);
 
-	if (!CDReader_IsOpen(&cd_reader))
-		return false;
+	if (disc_preload.enabled)
+	{
+		const retro_time_t start_time = libretro_callbacks.get_time_usec();
+		CDReader_StateBackup cd_reader_backup;
+		cc_u16f track_index;
+
+		CDReader_Open(&cd_reader, NULL, info->path, &clowncd_preloaded_callbacks);
+
+		if (!CDReader_IsOpen(&cd_reader))
+		{
+			ClownCDCallbacks_FreePreloadedFiles();
+			return false;
+		}
+
+		/* Audio tracks may be in files of their own, which are only opened when the tracks are played, so play each of them once now.
+		   The reader is put back the way that it was afterwards, so that neither the game nor save states can tell. */
+		CDReader_SaveState(&cd_reader, &cd_reader_backup);
+
+		for (track_index = 1; track_index <= 99; ++track_index)
+			CDReader_PlayAudio(&cd_reader, track_index, CDREADER_PLAYBACK_ONCE);
+
+		CDReader_LoadState(&cd_reader, &cd_reader_backup);
+
+		/* The worker threads open the disc's files too, so the files that are in memory must not change from now on. */
+		ClownCDCallbacks_FreezePreloadedFiles();
+
+		disc_preload.active = cc_true;
+
+		libretro_callbacks.log(RETRO_LOG_INFO, "Preloaded %luMiB of disc data in %lums.\n", (unsigned long)(ClownCDCallbacks_GetPreloadedSize() / (1024 * 1024)), (unsigned long)((libretro_callbacks.get_time_usec() - start_time) / 1000));
+	}
+	else
+	{
+		CDReader_Open(&cd_reader, NULL, info->path, &clowncd_callbacks);
+
+		if (!CDReader_IsOpen(&cd_reader))
+			return false;
+	}
+
+	/* Compressed discs are decoded to the disc cache the first time that they are loaded. */
+	if (disc_cache.size_limit != 0 && IsCHDFile(info->path))
+	{
+		char key[DISC_CACHE_KEY_LENGTH + 1];
+		cc_u32f total_sectors;
+
+		if (DiscCache_ComputeKey(&cd_reader, info->path, key, &total_sectors))
+		{
+			disc_cache.cache = DiscCache_Open(GetBuRAMDirectory(), key, total_sectors);
+
+			if (disc_cache.cache == NULL)
+				disc_cache.builder = DiscCacheBuilder_Create(GetBuRAMDirectory(), key, info->path, total_sectors, disc_cache.size_limit);
+		}
+	}
 
 	CDReader_SeekToSector(&cd_reader, 0);
+
+	cd_read_ahead.path = DuplicateString(info->path);
+	UpdateCDReadAhead();
+
 	return true;
 }
 
+static void UnloadCD(void)
+{
+	if (cd_read_ahead.read_ahead != NULL)
+	{
+		CDReadAhead_Destroy(cd_read_ahead.read_ahead);
+		cd_read_ahead.read_ahead = NULL;
+	}
+
+	if (cdda_decode_ahead.decode_ahead != NULL)
+	{
+		CDDADecodeAhead_Destroy(cdda_decode_ahead.decode_ahead);
+		cdda_decode_ahead.decode_ahead = NULL;
+	}
+
+	free(cd_read_ahead.path);
+	cd_read_ahead.path = NULL;
+	cd_read_ahead.reader_stale = cc_false;
+
+	if (disc_cache.cache != NULL)
+	{
+		DiscCache_Close(disc_cache.cache);
+		disc_cache.cache = NULL;
+	}
+
+	if (disc_cache.builder != NULL)
+	{
+		DiscCacheBuilder_Destroy(disc_cache.builder);
+		disc_cache.builder = NULL;
+	}
+
+	disc_cache.positioned = cc_false;
+
+	CDReader_Close(&cd_reader);
+
+	ClownCDCallbacks_FreePreloadedFiles();
+	disc_preload.active = cc_false;
+}
+
 static bool LoadCartridgeOrCD(const struct retro_game_info* const info)
 {
 	if (LoadCD(info))
@@ -1072,22 +2856,23 @@ static bool LoadCartridgeOrCD(const struct retro_game_info* const info)
 		if (CDReader_IsMegaCDGame(&cd_reader))
 			return true;
 
-		CDReader_Close(&cd_reader);
+		UnloadCD();
 	}
 
-	return LoadCartridge(info);
+	return LoadCartridge(info, 0);
 }
 
 static void UnloadCartridge(void)
 {
-	free(rom);
+	if (rom_mapped_size != 0)
+		FreeFileBuffer((unsigned char*)rom, rom_mapped_size, true);
+	else if (!rom_is_frontend_owned)
+		free(rom);
+
 	rom = NULL;
 	rom_length = 0;
-}
-
-static void UnloadCD(void)
-{
-	CDReader_Close(&cd_reader);
+	rom_is_frontend_owned = cc_false;
+	rom_mapped_size = 0;
 }
 
 bool retro_load_game(const struct retro_game_info* const info)
@@ -1099,6 +2884,15 @@ void retro_unload_game(void)
 {
 	UnloadCartridge();
 	UnloadCD();
+	BuRAMIndex_Clear();
+
+	if (rewind_buffer.history != NULL)
+		Rewind_Clear(rewind_buffer.history);
+
+	state_hash.frame_counter = 0;
+	cd_loading.loading = cc_false;
+	cd_loading.sectors_this_frame = 0;
+	CDTurbo_Reset();
 }
 
 unsigned int retro_get_region(void)
@@ -1113,6 +2907,9 @@ bool retro_load_game_special(const unsigned int type, const struct retro_game_in
 	if (type != 0)
 		return false;
 
+	/* The save directory is resolved again for each game. */
+	BuRAMIndex_Clear();
+
 	switch (num)
 	{
 		case 1:
@@ -1121,7 +2918,7 @@ bool retro_load_game_special(const unsigned int type, const struct retro_game_in
 			break;
 
 		case 2:
-			if (!LoadCartridge(&info[0]) || !LoadCD(&info[1]))
+			if (!LoadCartridge(&info[0], 0) || !LoadCD(&info[1]))
 				success = false;
 			break;
 
@@ -1140,45 +2937,188 @@ bool retro_load_game_special(const unsigned int type, const struct retro_game_in
 	/* Provide memory descriptors to the frontend (needed for achievements, cheats, and the like). */
 	SetMemoryMaps(rom, rom_length);
 
+	serialised_state_flags = GetSerialisedStateFlags();
+
 	/* Boot the emulated Mega Drive. */
 	retro_reset();
 
 	return true;
 }
 
-typedef struct SerialisedState
-{
-	ClownMDEmu_StateBackup clownmdemu;
-	CDReader_StateBackup cd_reader;
-} SerialisedState;
-
 size_t retro_serialize_size(void)
 {
-	return sizeof(SerialisedState);
+	return GetSerialisedStateSize(serialised_state_flags);
 }
 
 bool retro_serialize(void* const data, const size_t size)
 {
-	SerialisedState* const serialised_state = (SerialisedState*)data;
+	unsigned char* const bytes = (unsigned char*)data;
+	unsigned char* const core_section = bytes + sizeof(SerialisedStateHeader);
+	const uint32_t flags = serialised_state_flags;
+	const size_t core_section_size = GetCoreSectionSize(flags);
+
+	SerialisedStateHeader header;
+
+	if (size < GetSerialisedStateSize(flags))
+		return false;
+
+	memcpy(header.magic, serialised_state_magic, sizeof(header.magic));
+	header.version = SERIALISED_STATE_VERSION;
+	header.flags = flags;
+	header.core_section_size = core_section_size;
+	header.cd_reader_section_size = (flags & SERIALISED_STATE_FLAG_CD_READER) != 0 ? sizeof(SerialisedCDReaderState) : 0;
+	header.cd_turbo_state = (flags & SERIALISED_STATE_FLAG_CD_READER) != 0 ? CDTurbo_SaveState() : 0;
+	header.frame_counter = (uint32_t)state_hash.frame_counter;
+	memcpy(bytes, &header, sizeof(header));
+
+	if ((flags & SERIALISED_STATE_FLAG_MEGA_CD) != 0)
+	{
+		ClownMDEmu_SaveState(&clownmdemu, (ClownMDEmu_StateBackup*)core_section);
+	}
+	else
+	{
+		/* Copy everything but the Mega CD's memory. */
+		const unsigned char* const backup = (const unsigned char*)&state_backup_scratch;
+		unsigned char *output = core_section;
+		size_t position = 0;
+		size_t i;
+
+		ClownMDEmu_SaveState(&clownmdemu, &state_backup_scratch);
+
+		for (i = 0; i < CC_COUNT_OF(mega_cd_state_regions); ++i)
+		{
+			const size_t length = mega_cd_state_regions[i].backup_offset - position;
 
-	(void)size;
+			memcpy(output, &backup[position], length);
+			output += length;
+			position = mega_cd_state_regions[i].backup_offset + mega_cd_state_regions[i].size;
+		}
+
+		memcpy(output, &backup[position], sizeof(state_backup_scratch) - position);
+	}
+
+	if ((flags & SERIALISED_STATE_FLAG_CD_READER) != 0)
+	{
+		SerialisedCDReaderState cd_reader_state;
+		SaveCDReaderState(&cd_reader_state);
+		memcpy(core_section + core_section_size, &cd_reader_state, sizeof(cd_reader_state));
+	}
 
-	ClownMDEmu_SaveState(&clownmdemu, &serialised_state->clownmdemu);
-	CDReader_SaveState(&cd_reader, &serialised_state->cd_reader);
 	return true;
 }
 
 bool retro_unserialize(const void* const data, const size_t size)
 {
-	const SerialisedState* const serialised_state = (SerialisedState*)data;
+	const unsigned char* const bytes = (const unsigned char*)data;
+	const unsigned char* const core_section = bytes + sizeof(SerialisedStateHeader);
+	const uint32_t current_flags = serialised_state_flags;
+
+	SerialisedStateHeader header;
+
+	if (size < sizeof(header) || memcmp(bytes, serialised_state_magic, sizeof(serialised_state_magic)) != 0)
+		return UnserialiseLegacyState(data, size);
+
+	memcpy(&header, bytes, sizeof(header));
+
+	if (header.version != SERIALISED_STATE_VERSION)
+	{
+		libretro_callbacks.log(RETRO_LOG_ERROR, "Save state is not from this version of the core.\n");
+		return false;
+	}
+
+	/* Refuse states that lack the Mega CD memory or the CD reader state that the loaded content needs, or that were made by a build with a different state layout. */
+	if ((header.flags & current_flags) != (current_flags & (SERIALISED_STATE_FLAG_MEGA_CD | SERIALISED_STATE_FLAG_CD_READER))
+	 || ((header.flags & SERIALISED_STATE_FLAG_CD_READER) != 0 && !CDReader_IsOpen(&cd_reader))
+	 || header.core_section_size != GetCoreSectionSize(header.flags)
+	 || header.cd_reader_section_size != ((header.flags & SERIALISED_STATE_FLAG_CD_READER) != 0 ? sizeof(SerialisedCDReaderState) : 0)
+	 || size < GetSerialisedStateSize(header.flags))
+	{
+		libretro_callbacks.log(RETRO_LOG_ERROR, "Save state does not match the loaded content.\n");
+		return false;
+	}
+
+	if ((header.flags & SERIALISED_STATE_FLAG_MEGA_CD) != 0)
+	{
+		ClownMDEmu_LoadState(&clownmdemu, (const ClownMDEmu_StateBackup*)core_section);
+	}
+	else
+	{
+		/* Fill in the Mega CD's memory from the emulator itself, since it is unused and therefore unchanged. */
+		unsigned char* const backup = (unsigned char*)&state_backup_scratch;
+		const unsigned char *input = core_section;
+		size_t position = 0;
+		size_t i;
+
+		for (i = 0; i < CC_COUNT_OF(mega_cd_state_regions); ++i)
+		{
+			const size_t length = mega_cd_state_regions[i].backup_offset - position;
+
+			memcpy(&backup[position], input, length);
+			input += length;
+			position = mega_cd_state_regions[i].backup_offset;
+
+			memcpy(&backup[position], mega_cd_state_regions[i].memory, mega_cd_state_regions[i].size);
+			position += mega_cd_state_regions[i].size;
+		}
+
+		memcpy(&backup[position], input, sizeof(state_backup_scratch) - position);
+
+		ClownMDEmu_LoadState(&clownmdemu, &state_backup_scratch);
+	}
+
+	if ((header.flags & SERIALISED_STATE_FLAG_CD_READER) != 0)
+	{
+		SerialisedCDReaderState cd_reader_state;
+		memcpy(&cd_reader_state, core_section + header.core_section_size, sizeof(cd_reader_state));
+		LoadCDReaderState(&cd_reader_state.backup, cd_reader_state.audio_frame_offset);
+		CDTurbo_LoadState(header.cd_turbo_state);
+	}
 
-	(void)size;
+	state_hash.frame_counter = header.frame_counter;
 
-	ClownMDEmu_LoadState(&clownmdemu, &serialised_state->clownmdemu);
-	CDReader_LoadState(&cd_reader, &serialised_state->cd_reader);
 	return true;
 }
 
+unsigned int retro_clownmdemu_rewind(const unsigned int frames)
+{
+	const void *state = NULL;
+	unsigned int frames_stepped;
+
+	if (rewind_buffer.history == NULL)
+		return 0;
+
+	for (frames_stepped = 0; frames_stepped < frames; ++frames_stepped)
+	{
+		const void* const previous_state = Rewind_Step(rewind_buffer.history);
+
+		if (previous_state == NULL)
+			break;
+
+		state = previous_state;
+	}
+
+	if (state != NULL)
+	{
+		retro_unserialize(state, rewind_buffer.state_size);
+		rewind_buffer.stepped = cc_true;
+
+		/* The frame that the frontend has now is from the future. */
+		indexed_frame.frame_changed = cc_true;
+	}
+
+	return frames_stepped;
+}
+
+uint64_t retro_clownmdemu_get_state_hash(void)
+{
+	return StateHash_Compute();
+}
+
+unsigned long retro_clownmdemu_get_frame_counter(void)
+{
+	return state_hash.frame_counter;
+}
+
 void* retro_get_memory_data(const unsigned int id)
 {
 	switch (id)
@@ -1216,6 +3156,13 @@ size_t retro_get_memory_size(const unsigned int id)
 void retro_cheat_reset(void)
 {
 	libretro_callbacks.log(RETRO_LOG_INFO, "Resetting cheat codes.\n");
+
+	if (!MakeROMWritable())
+	{
+		libretro_callbacks.log(RETRO_LOG_ERROR, "Failed to copy the ROM for cheat codes.\n");
+		return;
+	}
+
 	CheatManager_ResetCheats(&cheat_manager, rom, rom_length);
 }
 
@@ -1231,6 +3178,12 @@ void retro_cheat_set(const unsigned int index, const bool enabled, const char* c
 
 	libretro_callbacks.log(RETRO_LOG_INFO, "Cheat code %u (%s) decoded to '%06lX-%04X'.\n", index, code, decoded_cheat.address, decoded_cheat.value);
 
+	if (!MakeROMWritable())
+	{
+		libretro_callbacks.log(RETRO_LOG_ERROR, "Failed to copy the ROM for cheat code %u (%s).\n", index, code);
+		return;
+	}
+
 	if (!CheatManager_AddDecodedCheat(&cheat_manager, rom, rom_length, index, enabled, &decoded_cheat))
 	{
 		libretro_callbacks.log(RETRO_LOG_ERROR, "Failed to %s cheat code %u (%s).\n", enabled ? "enable" : "disable", index, code);
@@ -14,8 +14,24 @@ typedef struct LibretroCallbacks
 	retro_input_poll_t         input_poll;
 	retro_input_state_t        input_state;
 	CC_ATTRIBUTE_PRINTF(2, 3) retro_log_printf_t log;
+	retro_perf_get_time_usec_t get_time_usec;
+	retro_get_cpu_features_t   get_cpu_features;
 } LibretroCallbacks;
 
 extern LibretroCallbacks libretro_callbacks;
 
+/* Extensions to the libretro API, for frontends that know about this core. */
+
+/* Steps back through the rewind buffer by up to 'frames' frames, and returns how many frames were actually stepped back.
+   Calling this with a 'frames' of 1 before each call to 'retro_run' rewinds the game smoothly. The rewind buffer is only
+   available when the 'clownmdemu_rewind_buffer' option is enabled, and is not recorded while run-ahead or netplay is in use. */
+RETRO_API unsigned int retro_clownmdemu_rewind(unsigned int frames);
+
+/* Returns a fast, non-cryptographic digest of the emulator's state and frame counter, for detecting netplay desyncs without exchanging whole states.
+   The whole state is hashed on every call, but the CD reader's state is not included. Digests are only comparable between builds for the same platform. */
+RETRO_API uint64_t retro_clownmdemu_get_state_hash(void);
+/* Returns the number of frames that have been run since the game was loaded, which is also logged alongside each digest.
+   It is saved in states, so loading one, such as during run-ahead, netplay, or rewinding, also restores the frame counter. */
+RETRO_API unsigned long retro_clownmdemu_get_frame_counter(void);
+
 #endif /* LIBRETRO_INTERFACE_H */
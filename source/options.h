@@ -331,6 +331,50 @@ struct retro_core_option_v2_definition option_defs_us[] = {
 		/* Default value. */
 		"disabled"
 	},
+	{
+		/* Key. */
+		"clownmdemu_log_state_hash",
+		/* Label. */
+		"Debug > Log State Hash",
+		/* Categorised label. */
+		"Log State Hash",
+		/* Description. */
+		"Log a hash of the emulated state at the end of every frame. Comparing the logs of two instances reveals the frame on which they went out of sync.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"debug",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_benchmark_pixel_conversion",
+		/* Label. */
+		"Debug > Benchmark Pixel Conversion",
+		/* Categorised label. */
+		"Benchmark Pixel Conversion",
+		/* Description. */
+		"When switched on, check every pixel conversion kernel that the CPU supports against the plain C one, and log how long each takes.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"debug",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
 	{
 		/* Key. */
 		"clownmdemu_tv_standard",
@@ -398,6 +442,54 @@ struct retro_core_option_v2_definition option_defs_us[] = {
 		/* Default value. */
 		"standard"
 	},
+	{
+		/* Key. */
+		"clownmdemu_input_polling",
+		/* Label. */
+		"Console > Input Polling",
+		/* Categorised label. */
+		"Input Polling",
+		/* Description. */
+		"When to ask the frontend for the state of the control pads. 'Start of Frame' does it before the frame is emulated. 'First Read' waits until the game reads a control pad, which can reduce input latency by up to a frame. 'Every Read' does it whenever the game reads a control pad, no more often than the Input Polling Interval.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"early", "Start of Frame"},
+			{"late", "First Read"},
+			{"continuous", "Every Read"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"early"
+	},
+	{
+		/* Key. */
+		"clownmdemu_input_polling_interval",
+		/* Label. */
+		"Console > Input Polling Interval",
+		/* Categorised label. */
+		"Input Polling Interval",
+		/* Description. */
+		"The minimum time between polls when Input Polling is set to 'Every Read'.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"0", "0ms"},
+			{"1", "1ms"},
+			{"2", "2ms"},
+			{"4", "4ms"},
+			{"8", "8ms"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"1"
+	},
 	{
 		/* Key. */
 		"clownmdemu_cd_addon",
@@ -406,7 +498,125 @@ struct retro_core_option_v2_definition option_defs_us[] = {
 		/* Categorised label. */
 		"CD Add-on",
 		/* Description. */
-		"Allow cartridge-only software to utilise features of the emulated Mega CD add-on, such as CD music. This may break some software.",
+		"Allow cartridge-only software to utilise features of the emulated Mega CD add-on, such as CD music. This may break some software. Save states only include the add-on's memory if this was enabled when the game was loaded.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_cd_read_ahead",
+		/* Label. */
+		"Console > CD Read-Ahead",
+		/* Categorised label. */
+		"CD Read-Ahead",
+		/* Description. */
+		"Read upcoming CD sectors on a separate thread, to avoid stutter when games stream data from compressed disc images such as CHD.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_cdda_decode_ahead",
+		/* Label. */
+		"Console > CD Audio Decode-Ahead",
+		/* Categorised label. */
+		"CD Audio Decode-Ahead",
+		/* Description. */
+		"Decode upcoming CD audio on a separate thread, to avoid stutter when games play music from compressed disc images such as CHD, or from cue sheets with FLAC, MP3 or Ogg Vorbis tracks.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_disc_cache",
+		/* Label. */
+		"Console > Disc Cache",
+		/* Categorised label. */
+		"Disc Cache",
+		/* Description. */
+		"Keep decoded copies of the data tracks of CHD disc images in the save directory, so that they do not need to be decompressed again the next time that they are played. The first time that a disc is played, it is decoded in the background. The least recently played discs are removed to stay within the chosen size.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"0", "Disabled"},
+			{"1024", "1GiB"},
+			{"2048", "2GiB"},
+			{"4096", "4GiB"},
+			{"8192", "8GiB"},
+			{"16384", "16GiB"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"0"
+	},
+	{
+		/* Key. */
+		"clownmdemu_disc_block_size",
+		/* Label. */
+		"Console > Disc Read Block Size",
+		/* Categorised label. */
+		"Disc Read Block Size",
+		/* Description. */
+		"Read disc image files in blocks of this size, so that many small reads become a few large ones. Larger blocks help with slow or networked storage. Takes effect the next time that a disc is loaded.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"0", "Disabled"},
+			{"16", "16KiB"},
+			{"32", "32KiB"},
+			{"64", "64KiB"},
+			{"128", "128KiB"},
+			{"256", "256KiB"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"64"
+	},
+	{
+		/* Key. */
+		"clownmdemu_disc_preload",
+		/* Label. */
+		"Console > Preload Disc",
+		/* Categorised label. */
+		"Preload Disc",
+		/* Description. */
+		"Read the whole disc image into memory when it is loaded, so that nothing is read from storage while the game is running. This helps with slow or networked storage, but uses as much memory as the image is large. Takes effect the next time that a disc is loaded.",
 		/* Categorised description. */
 		NULL,
 		/* Category. */
@@ -420,6 +630,56 @@ struct retro_core_option_v2_definition option_defs_us[] = {
 		/* Default value. */
 		"disabled"
 	},
+	{
+		/* Key. */
+		"clownmdemu_cd_loading_turbo",
+		/* Label. */
+		"Console > CD Loading Turbo",
+		/* Categorised label. */
+		"CD Loading Turbo",
+		/* Description. */
+		"Run Mega CD games faster while they are loading behind a still screen, by emulating several frames for each one that is shown. Only the last of those frames is heard. This is the most that loading is sped up by. The turbo is not used while run-ahead or netplay is in use.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"1", "Disabled"},
+			{"2", "2x"},
+			{"4", "4x"},
+			{"8", "8x"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"1"
+	},
+	{
+		/* Key. */
+		"clownmdemu_rewind_buffer",
+		/* Label. */
+		"Console > Rewind Buffer",
+		/* Categorised label. */
+		"Rewind Buffer",
+		/* Description. */
+		"Keep a history of recent frames within the core, so that frontends that support it can rewind without storing whole save states themselves. Larger buffers allow rewinding further back. Nothing is recorded while run-ahead or netplay is in use.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"console",
+		/* Values. */
+		{
+			{"0", "Disabled"},
+			{"16", "16MiB"},
+			{"32", "32MiB"},
+			{"64", "64MiB"},
+			{"128", "128MiB"},
+			{"256", "256MiB"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"0"
+	},
 	{
 		/* Key. */
 		"clownmdemu_tall_interlace_mode_2",
@@ -475,6 +735,167 @@ struct retro_core_option_v2_definition option_defs_us[] = {
 		/* Default value. */
 		"0"
 	},
+	{
+		/* Key. */
+		"clownmdemu_colour_conversion",
+		/* Label. */
+		"Video > Colour Conversion",
+		/* Categorised label. */
+		"Colour Conversion",
+		/* Description. */
+		"When to convert the emulated console's pixels to the frontend's pixel format. 'Whole Frame' waits until the frame is complete and converts it all at once, which is kinder to the CPU's cache. 'Worker Thread' converts each scanline on a separate thread while emulation continues, which helps on CPUs with more than one core.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"scanline", "Per Scanline"},
+			{"frame", "Whole Frame"},
+			{"threaded", "Worker Thread"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"scanline"
+	},
+	{
+		/* Key. */
+		"clownmdemu_duplicate_frames",
+		/* Label. */
+		"Video > Skip Duplicate Frames",
+		/* Categorised label. */
+		"Skip Duplicate Frames",
+		/* Description. */
+		"Detect frames that are identical to the previous one and have the frontend reuse it instead of uploading it again. Only works with 'Whole Frame' or 'Worker Thread' colour conversion, which keep a copy of the frame anyway. With 'Whole Frame', this also skips converting the frame.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"enabled", NULL},
+			{"disabled", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"enabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_frameskip",
+		/* Label. */
+		"Video > Frameskip",
+		/* Categorised label. */
+		"Frameskip",
+		/* Description. */
+		"Skip the rendering of frames to keep the game running at full speed on slow hardware. The game itself and its audio are unaffected. 'Auto' skips when the frontend warns that audio is about to underrun, 'Threshold' skips when the frontend's audio buffer is less full than the Frameskip Threshold, and 'Fixed' always skips the number of frames set by the Frameskip Interval.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"disabled", NULL},
+			{"auto", "Auto"},
+			{"threshold", "Threshold"},
+			{"fixed", "Fixed"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"disabled"
+	},
+	{
+		/* Key. */
+		"clownmdemu_frameskip_threshold",
+		/* Label. */
+		"Video > Frameskip Threshold (%)",
+		/* Categorised label. */
+		"Frameskip Threshold (%)",
+		/* Description. */
+		"When Frameskip is set to 'Threshold', frames are skipped while the frontend's audio buffer is less full than this.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"15", NULL},
+			{"18", NULL},
+			{"21", NULL},
+			{"24", NULL},
+			{"27", NULL},
+			{"30", NULL},
+			{"33", NULL},
+			{"36", NULL},
+			{"39", NULL},
+			{"42", NULL},
+			{"45", NULL},
+			{"48", NULL},
+			{"51", NULL},
+			{"54", NULL},
+			{"57", NULL},
+			{"60", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"33"
+	},
+	{
+		/* Key. */
+		"clownmdemu_frameskip_interval",
+		/* Label. */
+		"Video > Frameskip Interval",
+		/* Categorised label. */
+		"Frameskip Interval",
+		/* Description. */
+		"When Frameskip is set to 'Fixed', this is how many frames are skipped after each rendered one. Otherwise, it is the most that may be skipped in a row.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"1", NULL},
+			{"2", NULL},
+			{"3", NULL},
+			{"4", NULL},
+			{"5", NULL},
+			{"6", NULL},
+			{"7", NULL},
+			{"8", NULL},
+			{"9", NULL},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"3"
+	},
+	{
+		/* Key. */
+		"clownmdemu_fast_forward_frameskip",
+		/* Label. */
+		"Video > Fast-Forward Mode",
+		/* Categorised label. */
+		"Fast-Forward Mode",
+		/* Description. */
+		"Trade accuracy for speed while the frontend is fast-forwarding, by rendering only some frames and bypassing the low-pass filter. Full accuracy is restored when fast-forwarding ends.",
+		/* Categorised description. */
+		NULL,
+		/* Category. */
+		"video",
+		/* Values. */
+		{
+			{"0", "Disabled"},
+			{"1", "Render Every Frame"},
+			{"2", "Render 1 in 2 Frames"},
+			{"3", "Render 1 in 3 Frames"},
+			{"4", "Render 1 in 4 Frames"},
+			{"6", "Render 1 in 6 Frames"},
+			{"8", "Render 1 in 8 Frames"},
+			{NULL, NULL},
+		},
+		/* Default value. */
+		"0"
+	},
 	{
 		/* Key. */
 		"clownmdemu_lowpass_filter",
@@ -0,0 +1,357 @@
+#include "pixel-conversion.h"
+
+#include <string.h>
+
+/* Work out which SIMD kernels the compiler is able to produce. */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+		/* This is compiled with a per-function target attribute, so that the rest of the core does not require AVX2. */
+		#define PIXEL_CONVERSION_AVX2
+		#define TARGET_AVX2 __attribute__((target("avx2")))
+	#elif defined(_MSC_VER) && _MSC_VER >= 1800
+		#define PIXEL_CONVERSION_AVX2
+		#define TARGET_AVX2
+	#endif
+
+	/* SSE2 has no gather or table lookup instruction, so there is no SSE2 kernel: it would be no faster than the scalar one. */
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	/* 'vqtbl4q_u8' is AArch64-only, so 32-bit ARM uses the scalar kernel. */
+	#define PIXEL_CONVERSION_NEON
+	#define BASELINE_CPU_FEATURES RETRO_SIMD_NEON
+#endif
+
+#ifndef BASELINE_CPU_FEATURES
+	#define BASELINE_CPU_FEATURES 0
+#endif
+
+#ifdef PIXEL_CONVERSION_AVX2
+	#include <immintrin.h>
+#endif
+
+#ifdef PIXEL_CONVERSION_NEON
+	#include <arm_neon.h>
+#endif
+
+/**********/
+/* Scalar */
+/**********/
+
+static void Convert16Bit_Scalar(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source_pixel_pointer = source_pixels;
+	uint16_t *destination_pixel_pointer = (uint16_t*)destination_pixels;
+
+	size_t i;
+
+	for (i = 0; i < total_pixels; ++i)
+		*destination_pixel_pointer++ = palette->u16[*source_pixel_pointer++];
+}
+
+static void Convert32Bit_Scalar(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source_pixel_pointer = source_pixels;
+	uint32_t *destination_pixel_pointer = (uint32_t*)destination_pixels;
+
+	size_t i;
+
+	for (i = 0; i < total_pixels; ++i)
+		*destination_pixel_pointer++ = palette->u32[*source_pixel_pointer++];
+}
+
+/********/
+/* AVX2 */
+/********/
+
+#ifdef PIXEL_CONVERSION_AVX2
+TARGET_AVX2 static void Convert16Bit_AVX2(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source = source_pixels;
+	uint16_t *destination = (uint16_t*)destination_pixels;
+	const __m256i mask = _mm256_set1_epi32(0xFFFF);
+	size_t remaining;
+
+	for (remaining = total_pixels; remaining >= 16; remaining -= 16)
+	{
+		/* Gather 32-bit words at 16-bit strides, discard the upper halves, and then pack the two halves of the line back together. */
+		const __m128i indices = _mm_loadu_si128((const __m128i*)source);
+		const __m256i low = _mm256_and_si256(_mm256_i32gather_epi32((const int*)palette->u16, _mm256_cvtepu8_epi32(indices), 2), mask);
+		const __m256i high = _mm256_and_si256(_mm256_i32gather_epi32((const int*)palette->u16, _mm256_cvtepu8_epi32(_mm_srli_si128(indices, 8)), 2), mask);
+
+		/* 'packus' works on each 128-bit lane separately, so the 64-bit quarters must be reordered afterwards. */
+		_mm256_storeu_si256((__m256i*)destination, _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), _MM_SHUFFLE(3, 1, 2, 0)));
+
+		source += 16;
+		destination += 16;
+	}
+
+	Convert16Bit_Scalar(destination, source, palette, remaining);
+}
+
+TARGET_AVX2 static void Convert32Bit_AVX2(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source = source_pixels;
+	uint32_t *destination = (uint32_t*)destination_pixels;
+	size_t remaining;
+
+	for (remaining = total_pixels; remaining >= 8; remaining -= 8)
+	{
+		const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)source));
+
+		_mm256_storeu_si256((__m256i*)destination, _mm256_i32gather_epi32((const int*)palette->u32, indices, 4));
+
+		source += 8;
+		destination += 8;
+	}
+
+	Convert32Bit_Scalar(destination, source, palette, remaining);
+}
+#endif
+
+/********/
+/* NEON */
+/********/
+
+#ifdef PIXEL_CONVERSION_NEON
+/* The palette is split into byte planes, one 64-byte table per brightness, so that 'vqtbl4q_u8' can look up 16 pixels at once.
+   Indices that are out of range of a table produce 0, so the results of the three brightness tables can simply be OR'd together. */
+
+static uint8x16_t LookUpNEON(const uint8x16x4_t* const tables, const uint8x16_t indices[3])
+{
+	return vorrq_u8(vorrq_u8(vqtbl4q_u8(tables[0], indices[0]), vqtbl4q_u8(tables[1], indices[1])), vqtbl4q_u8(tables[2], indices[2]));
+}
+
+static void GetIndicesNEON(uint8x16_t indices[3], const cc_u8l* const source)
+{
+	indices[0] = vld1q_u8(source);
+	indices[1] = vsubq_u8(indices[0], vdupq_n_u8(64));
+	indices[2] = vsubq_u8(indices[0], vdupq_n_u8(128));
+}
+
+static void Convert16Bit_NEON(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source = source_pixels;
+	uint16_t *destination = (uint16_t*)destination_pixels;
+	uint8x16x4_t tables[2][3];
+	uint8x16_t indices[3];
+	uint8x16x2_t pixels;
+	size_t remaining;
+	unsigned int brightness, quarter;
+
+	for (brightness = 0; brightness < 3; ++brightness)
+	{
+		for (quarter = 0; quarter < 4; ++quarter)
+		{
+			const uint8x16x2_t planes = vld2q_u8((const uint8_t*)&palette->u16[brightness * 64 + quarter * 16]);
+
+			tables[0][brightness].val[quarter] = planes.val[0];
+			tables[1][brightness].val[quarter] = planes.val[1];
+		}
+	}
+
+	for (remaining = total_pixels; remaining >= 16; remaining -= 16)
+	{
+		GetIndicesNEON(indices, source);
+
+		pixels.val[0] = LookUpNEON(tables[0], indices);
+		pixels.val[1] = LookUpNEON(tables[1], indices);
+		vst2q_u8((uint8_t*)destination, pixels);
+
+		source += 16;
+		destination += 16;
+	}
+
+	Convert16Bit_Scalar(destination, source, palette, remaining);
+}
+
+static void Convert32Bit_NEON(void* const destination_pixels, const cc_u8l* const source_pixels, const PixelConversion_Palette* const palette, const size_t total_pixels)
+{
+	const cc_u8l *source = source_pixels;
+	uint32_t *destination = (uint32_t*)destination_pixels;
+	uint8x16x4_t tables[4][3];
+	uint8x16_t indices[3];
+	uint8x16x4_t pixels;
+	size_t remaining;
+	unsigned int brightness, quarter, plane;
+
+	for (brightness = 0; brightness < 3; ++brightness)
+	{
+		for (quarter = 0; quarter < 4; ++quarter)
+		{
+			const uint8x16x4_t planes = vld4q_u8((const uint8_t*)&palette->u32[brightness * 64 + quarter * 16]);
+
+			for (plane = 0; plane < 4; ++plane)
+				tables[plane][brightness].val[quarter] = planes.val[plane];
+		}
+	}
+
+	for (remaining = total_pixels; remaining >= 16; remaining -= 16)
+	{
+		GetIndicesNEON(indices, source);
+
+		for (plane = 0; plane < 4; ++plane)
+			pixels.val[plane] = LookUpNEON(tables[plane], indices);
+
+		vst4q_u8((uint8_t*)destination, pixels);
+
+		source += 16;
+		destination += 16;
+	}
+
+	Convert32Bit_Scalar(destination, source, palette, remaining);
+}
+#endif
+
+/*************/
+/* Selection */
+/*************/
+
+/* Kernels are preferred in this order. The scalar kernel must come last. */
+static const PixelConversion_Kernel kernels[] = {
+#ifdef PIXEL_CONVERSION_AVX2
+	{"AVX2",   RETRO_SIMD_AVX2, Convert16Bit_AVX2,   Convert32Bit_AVX2  },
+#endif
+#ifdef PIXEL_CONVERSION_NEON
+	{"NEON",   RETRO_SIMD_NEON, Convert16Bit_NEON,   Convert32Bit_NEON  },
+#endif
+	{"scalar", 0,               Convert16Bit_Scalar, Convert32Bit_Scalar}
+};
+
+#define TEST_LINE_WIDTH 320
+#define BENCHMARK_LINES (224 * 8)
+
+static PixelConversion_Palette test_palette;
+static cc_u8l test_source_pixels[TEST_LINE_WIDTH];
+static uint32_t test_expected_pixels[TEST_LINE_WIDTH + 1];
+static uint32_t test_actual_pixels[TEST_LINE_WIDTH + 1];
+
+static void GenerateTestData(void)
+{
+	/* A simple LCG, so that the test data is the same on every run. */
+	unsigned long seed = 0x2545F491;
+	size_t i;
+
+	for (i = 0; i < CC_COUNT_OF(test_palette.u32); ++i)
+	{
+		seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+		test_palette.u32[i] = (uint32_t)(seed ^ (seed << 16));
+	}
+
+	for (i = 0; i < CC_COUNT_OF(test_source_pixels); ++i)
+	{
+		seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+		test_source_pixels[i] = (cc_u8l)((seed >> 16) % PIXEL_CONVERSION_PALETTE_LENGTH);
+	}
+
+	/* Make sure that the edges of the palette are covered. */
+	test_source_pixels[0] = 0;
+	test_source_pixels[1] = PIXEL_CONVERSION_PALETTE_LENGTH - 1;
+}
+
+static cc_bool VerifyFunction(const PixelConversion_Function function, const PixelConversion_Function reference, const size_t bytes_per_pixel)
+{
+	size_t offset, length;
+
+	/* Cover every remainder that the scalar tail loops have to handle, as well as unaligned pointers. */
+	for (offset = 0; offset < 4; ++offset)
+	{
+		for (length = 0; length <= TEST_LINE_WIDTH - offset; length += length < 40 ? 1 : 23)
+		{
+			memset(test_expected_pixels, 0xAA, sizeof(test_expected_pixels));
+			memset(test_actual_pixels, 0xAA, sizeof(test_actual_pixels));
+
+			reference((unsigned char*)test_expected_pixels + offset * bytes_per_pixel, test_source_pixels + offset, &test_palette, length);
+			function((unsigned char*)test_actual_pixels + offset * bytes_per_pixel, test_source_pixels + offset, &test_palette, length);
+
+			if (memcmp(test_expected_pixels, test_actual_pixels, sizeof(test_expected_pixels)) != 0)
+				return cc_false;
+		}
+	}
+
+	return cc_true;
+}
+
+static retro_time_t BenchmarkFunction(const PixelConversion_Function function)
+{
+	retro_time_t start_time;
+	unsigned int i;
+
+	/* Warm the caches up first. */
+	function(test_actual_pixels, test_source_pixels, &test_palette, TEST_LINE_WIDTH);
+
+	start_time = libretro_callbacks.get_time_usec();
+
+	for (i = 0; i < BENCHMARK_LINES; ++i)
+		function(test_actual_pixels, test_source_pixels, &test_palette, TEST_LINE_WIDTH);
+
+	return libretro_callbacks.get_time_usec() - start_time;
+}
+
+static void LogBenchmark(const char* const format_name, const retro_time_t time, const retro_time_t scalar_time)
+{
+	const double nanoseconds_per_pixel = (double)time * 1000.0 / ((double)BENCHMARK_LINES * TEST_LINE_WIDTH);
+
+	if (time != 0)
+		libretro_callbacks.log(RETRO_LOG_INFO, "  %s: %.3fns per pixel (%.2fx scalar)\n", format_name, nanoseconds_per_pixel, (double)scalar_time / (double)time);
+	else
+		libretro_callbacks.log(RETRO_LOG_INFO, "  %s: %.3fns per pixel\n", format_name, nanoseconds_per_pixel);
+}
+
+static cc_bool IsKernelSupported(const PixelConversion_Kernel* const kernel, const uint64_t cpu_features)
+{
+	const uint64_t available_cpu_features = cpu_features | BASELINE_CPU_FEATURES;
+
+	return (kernel->required_cpu_features & available_cpu_features) == kernel->required_cpu_features;
+}
+
+const PixelConversion_Kernel* PixelConversion_SelectKernel(const uint64_t cpu_features)
+{
+	size_t i;
+
+	/* The scalar kernel comes last, and is always supported. */
+	for (i = 0; !IsKernelSupported(&kernels[i], cpu_features); ++i);
+
+	libretro_callbacks.log(RETRO_LOG_DEBUG, "Using %s pixel conversion kernel.\n", kernels[i].name);
+
+	return &kernels[i];
+}
+
+void PixelConversion_Benchmark(const uint64_t cpu_features)
+{
+	const PixelConversion_Kernel* const scalar_kernel = &kernels[CC_COUNT_OF(kernels) - 1];
+
+	retro_time_t scalar_time_16bit, scalar_time_32bit;
+	size_t i;
+
+	GenerateTestData();
+
+	scalar_time_16bit = BenchmarkFunction(scalar_kernel->convert_16bit);
+	scalar_time_32bit = BenchmarkFunction(scalar_kernel->convert_32bit);
+
+	libretro_callbacks.log(RETRO_LOG_INFO, "Pixel conversion kernels:\n");
+
+	for (i = 0; i < CC_COUNT_OF(kernels) - 1; ++i)
+	{
+		const PixelConversion_Kernel* const kernel = &kernels[i];
+
+		if (!IsKernelSupported(kernel, cpu_features))
+		{
+			libretro_callbacks.log(RETRO_LOG_INFO, "%s: unsupported by CPU\n", kernel->name);
+			continue;
+		}
+
+		if (!VerifyFunction(kernel->convert_16bit, scalar_kernel->convert_16bit, sizeof(uint16_t))
+		 || !VerifyFunction(kernel->convert_32bit, scalar_kernel->convert_32bit, sizeof(uint32_t)))
+		{
+			libretro_callbacks.log(RETRO_LOG_ERROR, "%s: output does not match the scalar kernel\n", kernel->name);
+			continue;
+		}
+
+		libretro_callbacks.log(RETRO_LOG_INFO, "%s:\n", kernel->name);
+		LogBenchmark("16-bit", BenchmarkFunction(kernel->convert_16bit), scalar_time_16bit);
+		LogBenchmark("32-bit", BenchmarkFunction(kernel->convert_32bit), scalar_time_32bit);
+	}
+
+	libretro_callbacks.log(RETRO_LOG_INFO, "%s:\n", scalar_kernel->name);
+	LogBenchmark("16-bit", scalar_time_16bit, scalar_time_16bit);
+	LogBenchmark("32-bit", scalar_time_32bit, scalar_time_32bit);
+}
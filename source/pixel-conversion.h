@@ -0,0 +1,32 @@
+#ifndef PIXEL_CONVERSION_H
+#define PIXEL_CONVERSION_H
+
+#include <stddef.h>
+
+#include "libretro-interface.h"
+
+#define PIXEL_CONVERSION_PALETTE_LENGTH (16 * 4 * 3) /* 16 colours, 4 palette lines, 3 brightnesses. */
+
+/* The 16-bit kernels may read two bytes past the end of 'u16', which the 'u32' member guarantees to be valid. */
+typedef union PixelConversion_Palette
+{
+	uint16_t u16[PIXEL_CONVERSION_PALETTE_LENGTH];
+	uint32_t u32[PIXEL_CONVERSION_PALETTE_LENGTH];
+} PixelConversion_Palette;
+
+typedef void (*PixelConversion_Function)(void *destination_pixels, const cc_u8l *source_pixels, const PixelConversion_Palette *palette, size_t total_pixels);
+
+typedef struct PixelConversion_Kernel
+{
+	const char *name;
+	uint64_t required_cpu_features;
+	PixelConversion_Function convert_16bit;
+	PixelConversion_Function convert_32bit;
+} PixelConversion_Kernel;
+
+/* Returns the preferred kernel that the CPU supports. 'cpu_features' is a mask of 'RETRO_SIMD_*' flags. */
+const PixelConversion_Kernel* PixelConversion_SelectKernel(uint64_t cpu_features);
+/* Checks that every kernel that the CPU supports produces identical output to the scalar one, and logs how long each takes. */
+void PixelConversion_Benchmark(uint64_t cpu_features);
+
+#endif /* PIXEL_CONVERSION_H */
@@ -0,0 +1,306 @@
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Runs of unchanged bytes shorter than this are stored anyway, since skipping them would cost about as much as storing them. */
+#define REWIND_MINIMUM_GAP 8
+
+/* The most bytes that 'WriteLength' can produce for a length that fits in 32 bits. */
+#define REWIND_MAXIMUM_LENGTH_SIZE 5
+
+/* Each record is surrounded by its size, so that the history can be walked from either end. */
+#define REWIND_RECORD_OVERHEAD (sizeof(size_t) * 2)
+
+struct Rewind
+{
+	/* The records of older states, oldest first. When the records wrap around to the start of the buffer,
+	   'wrap_point' marks where those at the end of the buffer stop. */
+	unsigned char *buffer;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+	size_t wrap_point;
+	cc_bool wrapped;
+	size_t total_records;
+
+	/* The newest state, in full. */
+	unsigned char *state;
+	size_t state_size;
+	cc_bool has_state;
+
+	/* Where records are encoded before being added to the buffer. */
+	unsigned char *scratch;
+};
+
+static unsigned char* WriteLength(unsigned char *output, size_t length)
+{
+	/* Lengths are usually small, so they are stored 7 bits at a time. */
+	while (length >= 0x80)
+	{
+		*output++ = (unsigned char)(length | 0x80);
+		length >>= 7;
+	}
+
+	*output++ = (unsigned char)length;
+
+	return output;
+}
+
+static const unsigned char* ReadLength(const unsigned char *input, size_t* const length)
+{
+	unsigned int shift = 0;
+
+	*length = 0;
+
+	for (;;)
+	{
+		const unsigned char byte = *input++;
+
+		*length |= (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+
+		if ((byte & 0x80) == 0)
+			break;
+	}
+
+	return input;
+}
+
+static size_t GetMaximumEncodedSize(const size_t state_size)
+{
+	/* Every run of changed bytes apart from the last is followed by at least 'REWIND_MINIMUM_GAP' unchanged ones. */
+	return state_size + (state_size / (REWIND_MINIMUM_GAP + 1) + 1) * REWIND_MAXIMUM_LENGTH_SIZE * 2;
+}
+
+static size_t EncodeDifference(unsigned char* const output, unsigned char* const old_state, const unsigned char* const new_state, const size_t size)
+{
+	/* Records the bytes of the old state that differ from the new state, and updates the old state to match as it goes.
+	   Each run of differing bytes is stored as the number of bytes since the previous run, its length, and then the bytes themselves. */
+	unsigned char *output_pointer = output;
+	size_t position = 0;
+	size_t previous_run_end = 0;
+
+	for (;;)
+	{
+		size_t run_start, run_end, unchanged_bytes;
+
+		/* Skip unchanged bytes, a block at a time where possible. */
+		while (position + 0x40 <= size && memcmp(&old_state[position], &new_state[position], 0x40) == 0)
+			position += 0x40;
+
+		while (position < size && old_state[position] == new_state[position])
+			++position;
+
+		if (position == size)
+			break;
+
+		/* Find the end of the run of changed bytes, absorbing any short gaps. */
+		run_start = position;
+		run_end = position;
+		unchanged_bytes = 0;
+
+		while (position < size && unchanged_bytes < REWIND_MINIMUM_GAP)
+		{
+			if (old_state[position] != new_state[position])
+			{
+				unchanged_bytes = 0;
+				run_end = position + 1;
+			}
+			else
+			{
+				++unchanged_bytes;
+			}
+
+			++position;
+		}
+
+		output_pointer = WriteLength(output_pointer, run_start - previous_run_end);
+		output_pointer = WriteLength(output_pointer, run_end - run_start);
+		memcpy(output_pointer, &old_state[run_start], run_end - run_start);
+		output_pointer += run_end - run_start;
+
+		memcpy(&old_state[run_start], &new_state[run_start], run_end - run_start);
+
+		previous_run_end = run_end;
+	}
+
+	return output_pointer - output;
+}
+
+static void DecodeDifference(unsigned char* const state, const unsigned char *input, const size_t input_size)
+{
+	const unsigned char* const input_end = input + input_size;
+	size_t position = 0;
+
+	while (input != input_end)
+	{
+		size_t skip, length;
+
+		input = ReadLength(input, &skip);
+		input = ReadLength(input, &length);
+
+		position += skip;
+		memcpy(&state[position], input, length);
+		input += length;
+		position += length;
+	}
+}
+
+static void DiscardOldestRecord(Rewind* const rewind)
+{
+	size_t record_size;
+
+	memcpy(&record_size, &rewind->buffer[rewind->tail], sizeof(record_size));
+	rewind->tail += REWIND_RECORD_OVERHEAD + record_size;
+	--rewind->total_records;
+
+	if (rewind->wrapped && rewind->tail == rewind->wrap_point)
+	{
+		rewind->tail = 0;
+		rewind->wrapped = cc_false;
+	}
+}
+
+static void AddRecord(Rewind* const rewind, const unsigned char* const record, const size_t record_size)
+{
+	const size_t total_size = REWIND_RECORD_OVERHEAD + record_size;
+
+	if (total_size > rewind->capacity)
+	{
+		/* This would not fit even in an empty buffer, so the history cannot continue past it. */
+		rewind->head = rewind->tail = 0;
+		rewind->wrapped = cc_false;
+		rewind->total_records = 0;
+		return;
+	}
+
+	/* Make room for the record, discarding the oldest ones as needed. */
+	for (;;)
+	{
+		if (rewind->total_records == 0)
+		{
+			rewind->head = rewind->tail = 0;
+			rewind->wrapped = cc_false;
+		}
+
+		if (!rewind->wrapped)
+		{
+			if (rewind->head + total_size <= rewind->capacity)
+				break;
+
+			rewind->wrap_point = rewind->head;
+			rewind->head = 0;
+			rewind->wrapped = cc_true;
+		}
+		else
+		{
+			if (rewind->head + total_size <= rewind->tail)
+				break;
+
+			DiscardOldestRecord(rewind);
+		}
+	}
+
+	memcpy(&rewind->buffer[rewind->head], &record_size, sizeof(record_size));
+	memcpy(&rewind->buffer[rewind->head + sizeof(record_size)], record, record_size);
+	memcpy(&rewind->buffer[rewind->head + sizeof(record_size) + record_size], &record_size, sizeof(record_size));
+	rewind->head += total_size;
+	++rewind->total_records;
+}
+
+Rewind* Rewind_Create(const size_t budget)
+{
+	Rewind* const rewind = (Rewind*)calloc(1, sizeof(Rewind));
+
+	if (rewind != NULL)
+	{
+		rewind->buffer = (unsigned char*)malloc(budget);
+		rewind->capacity = budget;
+
+		if (rewind->buffer != NULL)
+			return rewind;
+
+		free(rewind);
+	}
+
+	return NULL;
+}
+
+void Rewind_Destroy(Rewind* const rewind)
+{
+	free(rewind->scratch);
+	free(rewind->state);
+	free(rewind->buffer);
+	free(rewind);
+}
+
+void Rewind_Clear(Rewind* const rewind)
+{
+	rewind->head = rewind->tail = 0;
+	rewind->wrapped = cc_false;
+	rewind->total_records = 0;
+	rewind->has_state = cc_false;
+}
+
+size_t Rewind_Push(Rewind* const rewind, const void* const state, const size_t state_size)
+{
+	size_t record_size;
+
+	if (state_size != rewind->state_size)
+	{
+		Rewind_Clear(rewind);
+
+		free(rewind->scratch);
+		free(rewind->state);
+		rewind->state = (unsigned char*)malloc(state_size);
+		rewind->scratch = (unsigned char*)malloc(GetMaximumEncodedSize(state_size));
+
+		if (rewind->state == NULL || rewind->scratch == NULL)
+		{
+			free(rewind->scratch);
+			free(rewind->state);
+			rewind->scratch = NULL;
+			rewind->state = NULL;
+			rewind->state_size = 0;
+			return 0;
+		}
+
+		rewind->state_size = state_size;
+	}
+
+	if (!rewind->has_state)
+	{
+		memcpy(rewind->state, state, state_size);
+		rewind->has_state = cc_true;
+		return 0;
+	}
+
+	record_size = EncodeDifference(rewind->scratch, rewind->state, (const unsigned char*)state, state_size);
+	AddRecord(rewind, rewind->scratch, record_size);
+
+	return REWIND_RECORD_OVERHEAD + record_size;
+}
+
+const void* Rewind_Step(Rewind* const rewind)
+{
+	size_t record_size;
+
+	if (rewind->total_records == 0)
+		return NULL;
+
+	/* If the buffer has wrapped, but no records have been added at its start yet, then the newest record is at its end. */
+	if (rewind->wrapped && rewind->head == 0)
+	{
+		rewind->head = rewind->wrap_point;
+		rewind->wrapped = cc_false;
+	}
+
+	memcpy(&record_size, &rewind->buffer[rewind->head - sizeof(record_size)], sizeof(record_size));
+	rewind->head -= REWIND_RECORD_OVERHEAD + record_size;
+	--rewind->total_records;
+
+	DecodeDifference(rewind->state, &rewind->buffer[rewind->head + sizeof(record_size)], record_size);
+
+	return rewind->state;
+}
@@ -0,0 +1,25 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+
+#include "libretro-interface.h"
+
+typedef struct Rewind Rewind;
+
+/* A history of states, kept within a fixed memory budget. Only the newest state is stored whole: each older one
+   is stored as the difference between it and the state after it, with unchanged runs of bytes left out.
+   When the budget is exhausted, the oldest states are discarded. Returns NULL if memory could not be allocated. */
+Rewind* Rewind_Create(size_t budget);
+void Rewind_Destroy(Rewind *rewind);
+
+/* Discards every state. */
+void Rewind_Clear(Rewind *rewind);
+
+/* Adds a state to the history. If its size differs from that of the previous state, then the history is cleared first.
+   Returns the number of bytes of the budget that the previous state now occupies, or 0 if there was no previous state. */
+size_t Rewind_Push(Rewind *rewind, const void *state, size_t state_size);
+/* Discards the newest state and returns the one before it, or NULL if there is none. The state remains valid until the next call. */
+const void* Rewind_Step(Rewind *rewind);
+
+#endif /* REWIND_H */
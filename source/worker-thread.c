@@ -0,0 +1,274 @@
+#include "worker-thread.h"
+
+#include <stddef.h>
+
+/* The queue needs acquire/release ordering and full barriers, which C90 has no standard way of providing. */
+#ifdef HAVE_THREADS
+	#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+		#define WORKER_THREAD_ATOMICS_GNU
+	#elif defined(__GNUC__)
+		#define WORKER_THREAD_ATOMICS_SYNC
+	#elif defined(_MSC_VER)
+		#define WORKER_THREAD_ATOMICS_MSVC
+	#endif
+#endif
+
+#if defined(WORKER_THREAD_ATOMICS_GNU) || defined(WORKER_THREAD_ATOMICS_SYNC) || defined(WORKER_THREAD_ATOMICS_MSVC)
+
+#include <stdlib.h>
+
+#include <rthreads/rthreads.h>
+
+#ifdef WORKER_THREAD_ATOMICS_MSVC
+#include <windows.h>
+#endif
+
+struct WorkerThread
+{
+	WorkerThread_Callback callback;
+	void *user_data;
+
+	sthread_t *thread;
+	slock_t *lock;
+	scond_t *job_submitted;
+	scond_t *job_finished;
+
+	/* These are free-running counters: they wrap around, and the queue length divides evenly into their range. */
+	volatile unsigned int head; /* Only written by the submitting thread. */
+	cc_u16l queue[WORKER_THREAD_QUEUE_LENGTH];
+	volatile unsigned int tail; /* Only written by the worker thread. */
+
+	/* Each thread sets its flag before sleeping, so that the other knows to wake it. */
+	volatile unsigned int worker_sleeping;
+	volatile unsigned int submitter_sleeping;
+	volatile unsigned int quit;
+};
+
+static void FullBarrier(void)
+{
+#if defined(WORKER_THREAD_ATOMICS_GNU)
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#elif defined(WORKER_THREAD_ATOMICS_SYNC)
+	__sync_synchronize();
+#else
+	MemoryBarrier();
+#endif
+}
+
+static unsigned int LoadAcquire(const volatile unsigned int* const pointer)
+{
+#ifdef WORKER_THREAD_ATOMICS_GNU
+	return __atomic_load_n(pointer, __ATOMIC_ACQUIRE);
+#else
+	const unsigned int value = *pointer;
+	FullBarrier();
+	return value;
+#endif
+}
+
+static void StoreRelease(volatile unsigned int* const pointer, const unsigned int value)
+{
+#ifdef WORKER_THREAD_ATOMICS_GNU
+	__atomic_store_n(pointer, value, __ATOMIC_RELEASE);
+#else
+	FullBarrier();
+	*pointer = value;
+#endif
+}
+
+static void Wake(WorkerThread* const worker, scond_t* const condition)
+{
+	/* Taking the lock guarantees that the other thread is either inside 'scond_wait' or has not yet checked the queue. */
+	slock_lock(worker->lock);
+	scond_signal(condition);
+	slock_unlock(worker->lock);
+}
+
+static void WaitForPendingJobs(WorkerThread* const worker, const unsigned int maximum_pending_jobs)
+{
+	while (worker->head - LoadAcquire(&worker->tail) > maximum_pending_jobs)
+	{
+		slock_lock(worker->lock);
+
+		StoreRelease(&worker->submitter_sleeping, 1);
+		FullBarrier();
+
+		if (worker->head - LoadAcquire(&worker->tail) > maximum_pending_jobs)
+			scond_wait(worker->job_finished, worker->lock);
+
+		StoreRelease(&worker->submitter_sleeping, 0);
+
+		slock_unlock(worker->lock);
+	}
+}
+
+static void ThreadFunction(void* const user_data)
+{
+	WorkerThread* const worker = (WorkerThread*)user_data;
+
+	unsigned int tail = worker->tail;
+
+	for (;;)
+	{
+		if (LoadAcquire(&worker->head) != tail)
+		{
+			worker->callback(worker->user_data, worker->queue[tail % WORKER_THREAD_QUEUE_LENGTH]);
+
+			StoreRelease(&worker->tail, ++tail);
+			FullBarrier();
+
+			if (LoadAcquire(&worker->submitter_sleeping))
+				Wake(worker, worker->job_finished);
+		}
+		else
+		{
+			cc_bool quit;
+
+			slock_lock(worker->lock);
+
+			StoreRelease(&worker->worker_sleeping, 1);
+			FullBarrier();
+
+			quit = LoadAcquire(&worker->quit) != 0;
+
+			if (!quit && LoadAcquire(&worker->head) == tail)
+				scond_wait(worker->job_submitted, worker->lock);
+
+			StoreRelease(&worker->worker_sleeping, 0);
+
+			slock_unlock(worker->lock);
+
+			if (quit)
+				break;
+		}
+	}
+}
+
+WorkerThread* WorkerThread_Create(const WorkerThread_Callback callback, void* const user_data)
+{
+	WorkerThread* const worker = (WorkerThread*)calloc(1, sizeof(WorkerThread));
+
+	if (worker != NULL)
+	{
+		worker->callback = callback;
+		worker->user_data = user_data;
+
+		worker->lock = slock_new();
+
+		if (worker->lock != NULL)
+		{
+			worker->job_submitted = scond_new();
+
+			if (worker->job_submitted != NULL)
+			{
+				worker->job_finished = scond_new();
+
+				if (worker->job_finished != NULL)
+				{
+					worker->thread = sthread_create(ThreadFunction, worker);
+
+					if (worker->thread != NULL)
+						return worker;
+
+					scond_free(worker->job_finished);
+				}
+
+				scond_free(worker->job_submitted);
+			}
+
+			slock_free(worker->lock);
+		}
+
+		free(worker);
+	}
+
+	return NULL;
+}
+
+void WorkerThread_Destroy(WorkerThread* const worker)
+{
+	WorkerThread_Finish(worker);
+
+	slock_lock(worker->lock);
+	StoreRelease(&worker->quit, 1);
+	scond_signal(worker->job_submitted);
+	slock_unlock(worker->lock);
+
+	sthread_join(worker->thread);
+
+	scond_free(worker->job_finished);
+	scond_free(worker->job_submitted);
+	slock_free(worker->lock);
+	free(worker);
+}
+
+void WorkerThread_Submit(WorkerThread* const worker, const cc_u16f job)
+{
+	const unsigned int head = worker->head;
+
+	WaitForPendingJobs(worker, WORKER_THREAD_QUEUE_LENGTH - 1);
+
+	worker->queue[head % WORKER_THREAD_QUEUE_LENGTH] = job;
+
+	StoreRelease(&worker->head, head + 1);
+	FullBarrier();
+
+	if (LoadAcquire(&worker->worker_sleeping))
+		Wake(worker, worker->job_submitted);
+}
+
+void WorkerThread_Finish(WorkerThread* const worker)
+{
+	WaitForPendingJobs(worker, 0);
+}
+
+cc_u16f WorkerThread_GetPendingJobs(WorkerThread* const worker)
+{
+	return worker->head - LoadAcquire(&worker->tail);
+}
+
+void WorkerThread_WaitForPendingJobs(WorkerThread* const worker, const cc_u16f maximum_pending_jobs)
+{
+	WaitForPendingJobs(worker, maximum_pending_jobs);
+}
+
+#else
+
+WorkerThread* WorkerThread_Create(const WorkerThread_Callback callback, void* const user_data)
+{
+	(void)callback;
+	(void)user_data;
+
+	return NULL;
+}
+
+void WorkerThread_Destroy(WorkerThread* const worker)
+{
+	(void)worker;
+}
+
+void WorkerThread_Submit(WorkerThread* const worker, const cc_u16f job)
+{
+	(void)worker;
+	(void)job;
+}
+
+void WorkerThread_Finish(WorkerThread* const worker)
+{
+	(void)worker;
+}
+
+cc_u16f WorkerThread_GetPendingJobs(WorkerThread* const worker)
+{
+	(void)worker;
+
+	return 0;
+}
+
+void WorkerThread_WaitForPendingJobs(WorkerThread* const worker, const cc_u16f maximum_pending_jobs)
+{
+	(void)worker;
+	(void)maximum_pending_jobs;
+}
+
+#endif
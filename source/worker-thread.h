@@ -0,0 +1,28 @@
+#ifndef WORKER_THREAD_H
+#define WORKER_THREAD_H
+
+#include "libretro-interface.h"
+
+/* The maximum number of jobs that can be submitted before the queue is full. */
+#define WORKER_THREAD_QUEUE_LENGTH 0x200
+
+typedef void (*WorkerThread_Callback)(void *user_data, cc_u16f job);
+
+typedef struct WorkerThread WorkerThread;
+
+/* A thread that processes jobs from a single-producer single-consumer queue, which does not need a lock
+   unless one of the two threads has to sleep. Jobs are just numbers, whose meaning is up to the callback.
+   Returns NULL if threads (or the atomic operations that the queue relies on) are not available. */
+WorkerThread* WorkerThread_Create(WorkerThread_Callback callback, void *user_data);
+void WorkerThread_Destroy(WorkerThread *worker);
+
+/* Any memory written before a job is submitted is visible to the callback. If the queue is full, this blocks. */
+void WorkerThread_Submit(WorkerThread *worker, cc_u16f job);
+/* Blocks until every submitted job has been processed. Any memory written by the callback is visible afterwards. */
+void WorkerThread_Finish(WorkerThread *worker);
+/* Jobs are processed in the order that they were submitted, so these can be used to wait for a particular job.
+   As with 'WorkerThread_Finish', any memory written by the callback for the finished jobs is visible afterwards. */
+cc_u16f WorkerThread_GetPendingJobs(WorkerThread *worker);
+void WorkerThread_WaitForPendingJobs(WorkerThread *worker, cc_u16f maximum_pending_jobs);
+
+#endif /* WORKER_THREAD_H */
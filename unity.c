@@ -1,4 +1,14 @@
+#include "source/cd-read-ahead.c"
+#include "source/cdda-decode-ahead.c"
 #include "source/clowncd-callbacks.c"
+#include "source/disc-cache.c"
 #include "source/file-io.c"
 #include "source/libretro-interface.c"
+#include "source/pixel-conversion.c"
+#include "source/rewind.c"
+#include "source/worker-thread.c"
 #include "common/unity.c"
+
+#ifdef HAVE_THREADS
+#include "libretro-common/rthreads/rthreads.c"
+#endif